@@ -0,0 +1,573 @@
+/**
+    Bollie Retain - (c) 2016 Thomas Ebeling https://ca9.eu
+
+    This file is part of bollieretain.lv2
+
+    bollieretain.lv2 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    bollieretain.lv2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with bollieretain.lv2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+* \file bollie-retain-kernels.h
+* \author Bollie
+* \brief Hot loops of the retainer, built once per instruction set
+*
+* Included several times by bollie-retain.c, each time under another target
+* pragma and with KERNEL(name) giving the copy its own names. No include
+* guard on purpose.
+*/
+
+
+/**
+* Adds a grain read at unit speed.
+* \param wet_l mid signal to add to
+* \param wet_r side signal to add to
+* \param src_l mid tape at the grain phase
+* \param src_r side tape at the grain phase
+* \param window Hann window at the grain phase
+* \param pan_a mid/side pan matrix diagonal
+* \param pan_b mid/side pan matrix off diagonal
+* \param len number of samples
+*/
+static void KERNEL(add_grain)(float* restrict wet_l, float* restrict wet_r,
+    const float* restrict src_l, const float* restrict src_r,
+    const float* restrict window, float pan_a, float pan_b, int len) {
+    for (int i = 0 ; i < len ; ++i) {
+        wet_l[i] += (src_l[i] * pan_a + src_r[i] * pan_b) * window[i];
+        wet_r[i] += (src_l[i] * pan_b + src_r[i] * pan_a) * window[i];
+    }
+}
+
+
+/**
+* Adds a grain read at another speed.
+* \param wet_l mid signal to add to
+* \param wet_r side signal to add to
+* \param tape_l mid tape
+* \param tape_r side tape
+* \param src tape position of the grain
+* \param phase progress of the grain
+* \param rate playback speed
+* \param window Hann window at the grain phase
+* \param pan_a mid/side pan matrix diagonal
+* \param pan_b mid/side pan matrix off diagonal
+* \param len number of samples
+* \param cubic read with Hermite instead of linear interpolation
+*/
+static void KERNEL(add_pitched_grain)(float* restrict wet_l,
+    float* restrict wet_r, const float* restrict tape_l,
+    const float* restrict tape_r, int src, int phase, float rate,
+    const float* restrict window, float pan_a, float pan_b, int len,
+    int cubic) {
+    if (cubic) {
+        for (int i = 0 ; i < len ; ++i) {
+            float x = (phase + i) * rate;
+            int k = x;
+            float s_l = hermite(tape_l, src + k, x - k);
+            float s_r = hermite(tape_r, src + k, x - k);
+            wet_l[i] += (s_l * pan_a + s_r * pan_b) * window[i];
+            wet_r[i] += (s_l * pan_b + s_r * pan_a) * window[i];
+        }
+        return;
+    }
+
+    const float* restrict src_l = tape_l + src;
+    const float* restrict src_r = tape_r + src;
+    for (int i = 0 ; i < len ; ++i) {
+        float x = (phase + i) * rate;
+        int k = x;
+        float f = x - k;
+        float s_l = src_l[k] + (src_l[k + 1] - src_l[k]) * f;
+        float s_r = src_r[k] + (src_r[k + 1] - src_r[k]) * f;
+        wet_l[i] += (s_l * pan_a + s_r * pan_b) * window[i];
+        wet_r[i] += (s_l * pan_b + s_r * pan_a) * window[i];
+    }
+}
+
+
+/**
+* Mixes the compact band tapes back to full scale.
+* \param low_l low band tape mid
+* \param low_r low band tape side
+* \param high_l high band tape mid
+* \param high_r high band tape side
+* \param low low band gain, including the compact scale
+* \param high high band gain, including the compact scale
+* \param out_l mid output
+* \param out_r side output
+* \param n number of samples
+*/
+static void KERNEL(decode_bands)(const int16_t* restrict low_l,
+    const int16_t* restrict low_r, const int16_t* restrict high_l,
+    const int16_t* restrict high_r, float low, float high,
+    float* restrict out_l, float* restrict out_r, uint32_t n) {
+    for (uint32_t i = 0 ; i < n ; ++i) {
+        out_l[i] = low_l[i] * low + high_l[i] * high;
+        out_r[i] = low_r[i] * low + high_r[i] * high;
+    }
+}
+
+
+/**
+* Runs one biquad over a stereo signal, left and right as one vector.
+* Transposed direct form II, input and output may be the same.
+* \param c coefficients
+* \param z1 first state
+* \param z2 second state
+* \param in_l left input
+* \param in_r right input
+* \param out_l left output
+* \param out_r right output
+* \param n number of samples
+*/
+static void KERNEL(biquad_stage)(const Biquad* c, stereo_t* z1,
+    stereo_t* z2, const float* in_l, const float* in_r, float* out_l,
+    float* out_r, uint32_t n) {
+    stereo_t s1 = *z1;
+    stereo_t s2 = *z2;
+
+    for (uint32_t i = 0 ; i < n ; ++i) {
+        stereo_t x = { in_l[i], in_r[i] };
+        stereo_t y = c->b0 * x + s1;
+        s1 = c->b1 * x - c->a1 * y + s2;
+        s2 = c->b2 * x - c->a2 * y;
+        out_l[i] = y[0];
+        out_r[i] = y[1];
+    }
+    *z1 = s1;
+    *z2 = s2;
+}
+
+
+/**
+* Applies a linear gain ramp.
+* \param l left signal
+* \param r right signal
+* \param n number of samples
+* \param gain gain of the first sample
+* \param step gain increment per sample
+*/
+static void KERNEL(ramp)(float* restrict l, float* restrict r, uint32_t n,
+    float gain, float step) {
+    for (uint32_t i = 0 ; i < n ; ++i) {
+        float g = gain + step * i;
+        l[i] *= g;
+        r[i] *= g;
+    }
+}
+
+
+/**
+* Writes a loop phase ramp, zero in the preroll.
+* \param out phase output
+* \param phase phase of the first sample
+* \param step phase increment per sample
+* \param n number of samples
+*/
+static void KERNEL(phase_ramp)(float* restrict out, float phase, float step,
+    uint32_t n) {
+    for (uint32_t i = 0 ; i < n ; ++i) {
+        out[i] = fmaxf(phase + step * i, 0);
+    }
+}
+
+
+/**
+* Accumulates energy and peak of a stereo signal.
+* \param in_l left input
+* \param in_r right input
+* \param n number of samples
+* \param energy sum of squares to add to
+* \param peak peak level to update
+*/
+static void KERNEL(measure)(const float* restrict in_l,
+    const float* restrict in_r, uint32_t n, double* energy, float* peak) {
+    float sum = 0;
+    float max = *peak;
+
+    for (uint32_t i = 0 ; i < n ; ++i) {
+        sum += in_l[i] * in_l[i] + in_r[i] * in_r[i];
+        max = fmaxf(max, fmaxf(fabsf(in_l[i]), fabsf(in_r[i])));
+    }
+    *energy += sum;
+    *peak = max;
+}
+
+
+/**
+* Converts a signal to the compact tape format, clipped at COMPACT_RANGE.
+* \param in signal
+* \param out compact tape
+* \param n number of samples
+*/
+static void KERNEL(compact)(const float* restrict in, int16_t* restrict out,
+    uint32_t n) {
+    for (uint32_t i = 0 ; i < n ; ++i) {
+        float x = fminf(fmaxf(in[i], -COMPACT_RANGE), COMPACT_RANGE);
+        out[i] = x * COMPACT_SCALE;
+    }
+}
+
+
+/**
+* Correlates two tape segments.
+* \param a first segment
+* \param b second segment
+* \param n segment length
+* \param stride distance of the samples compared
+* \return sum of products
+*/
+static float KERNEL(correlate)(const float* restrict a,
+    const float* restrict b, int n, int stride) {
+    float score = 0;
+
+    // Unit stride is a plain dot product and vectorizes
+    if (stride == 1) {
+        for (int j = 0 ; j < n ; ++j) {
+            score += a[j] * b[j];
+        }
+        return score;
+    }
+    for (int j = 0 ; j < n ; j += stride) {
+        score += a[j] * b[j];
+    }
+    return score;
+}
+
+
+/**
+* Renders a segment of one sampler voice onto the wet signal. The samples
+* are the vector lanes: positions, seam fades and gains are computed per
+* sample, the tape reads gather.
+* \param self current plugin instance
+* \param v voice index
+* \param wet_l mid signal to add to
+* \param wet_r side signal to add to
+* \param len number of samples, up to CONTROL_LEN
+* \param cubic cubic interpolation instead of linear, a constant
+* \param seam the segment reaches the seam, a constant
+*/
+static inline void KERNEL(sampler_voice)(const BollieRetain* self, int v,
+    float* restrict wet_l, float* restrict wet_r, uint32_t len, int cubic,
+    int seam) {
+    const float* restrict buffer_l = self->buffer_l;
+    const float* restrict buffer_r = self->buffer_r;
+    float loop_start = self->loop_start;
+    float period = self->loop_end - self->loop_start;
+    float inv_period = 1.0f / period;
+    float seam_start = self->loop_end - self->n_seam_samples;
+    float inv_seam = self->n_seam_samples ? 1.0f / self->n_seam_samples : 0;
+    int smooth_seam = self->tier->smooth_seam;
+    float pos = self->voice_pos[v];
+    float rate = self->voice_rate[v];
+    float gain = self->voice_gain[v];
+    float gain_step = self->voice_gain_step[v];
+
+    for (uint32_t i = 0 ; i < len ; ++i) {
+        // Positions start inside the loop and wrap at its end
+        float p = pos + i * rate;
+        p -= period * (int)((p - loop_start) * inv_period);
+        int k = p;
+        float f = p - k;
+        float s_l, s_r;
+        if (cubic) {
+            s_l = hermite(buffer_l, k, f);
+            s_r = hermite(buffer_r, k, f);
+        }
+        else {
+            s_l = buffer_l[k] + (buffer_l[k + 1] - buffer_l[k]) * f;
+            s_r = buffer_r[k] + (buffer_r[k + 1] - buffer_r[k]) * f;
+        }
+
+        // Seam crossfade into the material before loop_start
+        if (seam) {
+            float c = fminf(fmaxf((p - seam_start) * inv_seam, 0), 1.0f);
+            int k2 = c > 0 ? k - (int)period : k;
+            float t_l, t_r;
+            if (cubic) {
+                t_l = hermite(buffer_l, k2, f);
+                t_r = hermite(buffer_r, k2, f);
+            }
+            else {
+                t_l = buffer_l[k2] + (buffer_l[k2 + 1] - buffer_l[k2]) * f;
+                t_r = buffer_r[k2] + (buffer_r[k2 + 1] - buffer_r[k2]) * f;
+            }
+            if (smooth_seam) {
+                c = c * c * (3.0f - 2.0f * c);
+            }
+            s_l += (t_l - s_l) * c;
+            s_r += (t_r - s_r) * c;
+        }
+
+        float g = gain + (i + 1) * gain_step;
+        wet_l[i] += s_l * g;
+        wet_r[i] += s_r * g;
+    }
+}
+
+
+/**
+* Renders a segment of all sampler voices, envelopes are up to date.
+* Silent voices only move on, the others are rendered one by one, with
+* the seam crossfade only if they reach the seam.
+* \param self current plugin instance
+* \param wet_l mid output
+* \param wet_r side output
+* \param len number of samples, up to CONTROL_LEN
+*/
+static void KERNEL(sampler_segment)(BollieRetain* self, float* restrict wet_l,
+    float* restrict wet_r, uint32_t len) {
+    float loop_start = self->loop_start;
+    float period = self->loop_end - self->loop_start;
+    float inv_period = 1.0f / period;
+    float seam_start = self->loop_end - self->n_seam_samples;
+    int cubic = self->tier->cubic;
+
+    memset(wet_l, 0, len * sizeof(float));
+    memset(wet_r, 0, len * sizeof(float));
+    for (int v = 0 ; v < SAMPLER_VOICES ; ++v) {
+        float p = self->voice_pos[v] + len * self->voice_rate[v];
+        int seam = p >= seam_start;
+        if (self->voice_gain[v] == 0 && self->voice_gain_step[v] == 0) {
+            // Silent
+        }
+        else if (cubic && seam) {
+            KERNEL(sampler_voice)(self, v, wet_l, wet_r, len, true, true);
+        }
+        else if (cubic) {
+            KERNEL(sampler_voice)(self, v, wet_l, wet_r, len, true, false);
+        }
+        else if (seam) {
+            KERNEL(sampler_voice)(self, v, wet_l, wet_r, len, false, true);
+        }
+        else {
+            KERNEL(sampler_voice)(self, v, wet_l, wet_r, len, false, false);
+        }
+        self->voice_pos[v] = p - period * (int)((p - loop_start)
+            * inv_period);
+        self->voice_gain[v] += len * self->voice_gain_step[v];
+    }
+}
+
+
+/**
+* Renders a segment of all sustain voices, positions are inside the loop.
+* Fades in, or out while a capture is pending. The segment is split where
+* voices wrap, within a span the tape reads are contiguous and the
+* envelopes are linear. The voices of both sides are the lanes of the
+* allpasses, the samples run through them one after the other.
+* \param self current plugin instance
+* \param wet_l mid output
+* \param wet_r side output
+* \param n number of samples, up to CONTROL_LEN
+* \return number of samples rendered, less than n when faded out
+*/
+static uint32_t KERNEL(sustain_segment)(BollieRetain* self,
+    float* restrict wet_l, float* restrict wet_r, uint32_t n) {
+    float x[CONTROL_LEN][2 * SUSTAIN_VOICES];
+    float y[CONTROL_LEN][2 * SUSTAIN_VOICES];
+    const float* hann = self->hann;
+    int* pos = self->sustain_pos;
+    int loop_start = self->loop_start;
+    int loop_end = self->loop_end;
+    int period = loop_end - loop_start;
+
+    // Envelope from the Hann table, scaled from the loop period
+    float scale = (float)(self->n_grain_samples - 1) / period;
+    int last = self->n_grain_samples - 2;
+    float norm = self->sustain_norm;
+    float gain = self->sustain_gain;
+    float gain_step = 1.0f / self->n_fade_samples;
+    if (self->listening) {
+        gain_step = -gain_step;
+        int left = ceilf(gain * self->n_fade_samples) - 1;
+        if (left < (int)n) {
+            n = left > 0 ? left : 0;
+        }
+    }
+
+    for (uint32_t i0 = 0 ; i0 < n ; ) {
+        // Span up to the next wrap of a voice
+        uint32_t i1 = n;
+        const float* tape_l[SUSTAIN_VOICES];
+        const float* tape_r[SUSTAIN_VOICES];
+        float env[SUSTAIN_VOICES];
+        float env_step[SUSTAIN_VOICES];
+        for (int v = 0 ; v < SUSTAIN_VOICES ; ++v) {
+            if ((uint32_t)(loop_end - pos[v]) + i0 < i1) {
+                i1 = loop_end - pos[v] + i0;
+            }
+        }
+        for (int v = 0 ; v < SUSTAIN_VOICES ; ++v) {
+            float h0 = (pos[v] - loop_start) * scale;
+            float h1 = h0 + (i1 - i0) * scale;
+            int k0 = h0 < last ? (int)h0 : last;
+            int k1 = h1 < last ? (int)h1 : last;
+            float e0 = hann[k0] + (hann[k0 + 1] - hann[k0]) * (h0 - k0);
+            float e1 = hann[k1] + (hann[k1 + 1] - hann[k1]) * (h1 - k1);
+            env_step[v] = (e1 - e0) / (i1 - i0);
+            env[v] = e0;
+            tape_l[v] = self->buffer_l + pos[v];
+            tape_r[v] = self->buffer_r + pos[v];
+            pos[v] += i1 - i0;
+            if (pos[v] >= loop_end) {
+                pos[v] -= period;
+            }
+        }
+        for (uint32_t i = i0 ; i < i1 ; ++i) {
+            for (int v = 0 ; v < SUSTAIN_VOICES ; ++v) {
+                float e = env[v] + (i - i0) * env_step[v];
+                x[i][v] = tape_l[v][i - i0] * e;
+                x[i][SUSTAIN_VOICES + v] = tape_r[v][i - i0] * e;
+            }
+        }
+        i0 = i1;
+    }
+
+    // Allpasses with the voices as lanes, mid and side one vector each
+    voices_t coeff_l = self->sustain_coeff[0];
+    voices_t coeff_r = self->sustain_coeff[1];
+    voices_t x1_l = self->sustain_x1[0];
+    voices_t x1_r = self->sustain_x1[1];
+    voices_t y1_l = self->sustain_y1[0];
+    voices_t y1_r = self->sustain_y1[1];
+    for (uint32_t i = 0 ; i < n ; ++i) {
+        voices_t x_l;
+        voices_t x_r;
+        memcpy(&x_l, x[i], sizeof(x_l));
+        memcpy(&x_r, x[i] + SUSTAIN_VOICES, sizeof(x_r));
+        y1_l = coeff_l * (x_l - y1_l) + x1_l;
+        y1_r = coeff_r * (x_r - y1_r) + x1_r;
+        x1_l = x_l;
+        x1_r = x_r;
+        memcpy(y[i], &y1_l, sizeof(y1_l));
+        memcpy(y[i] + SUSTAIN_VOICES, &y1_r, sizeof(y1_r));
+    }
+    self->sustain_x1[0] = x1_l;
+    self->sustain_x1[1] = x1_r;
+    self->sustain_y1[0] = y1_l;
+    self->sustain_y1[1] = y1_r;
+
+    // Voice sums with the fade
+    for (uint32_t i = 0 ; i < n ; ++i) {
+        float sum_l = 0;
+        float sum_r = 0;
+        for (int v = 0 ; v < SUSTAIN_VOICES ; ++v) {
+            sum_l += y[i][v];
+            sum_r += y[i][SUSTAIN_VOICES + v];
+        }
+        float g = fminf(gain + (i + 1) * gain_step, 1.0f) * norm;
+        wet_l[i] = sum_l * g;
+        wet_r[i] = sum_r * g;
+    }
+    self->sustain_gain = fminf(fmaxf(gain + n * gain_step, 0), 1.0f);
+    return n;
+}
+
+
+/**
+* Writes the input scaled by a gain ramp, the dry part of a mix. The
+* output may be the input buffer of an in-place host.
+* \param input_l left input
+* \param input_r right input
+* \param output_l left output
+* \param output_r right output
+* \param n number of samples
+* \param gain gain before the first sample
+* \param step gain increment per sample
+*/
+static void KERNEL(pass_dry)(const float* input_l, const float* input_r,
+    float* output_l, float* output_r, uint32_t n, float gain, float step) {
+    for (uint32_t i = 0 ; i < n ; ++i) {
+        float dry = gain + step * (i + 1);
+        output_l[i] = input_l[i] * dry;
+        output_r[i] = input_r[i] * dry;
+    }
+}
+
+
+/**
+* Mixes the input and the decoded mid/side wet signal. The output may be
+* the input buffer of an in-place host.
+* \param input_l left input
+* \param input_r right input
+* \param wet_l wet mid signal
+* \param wet_r wet side signal
+* \param output_l left output
+* \param output_r right output
+* \param n number of samples
+* \param dry dry gain before the first sample
+* \param dry_step dry gain increment per sample
+* \param wet wet gain before the first sample
+* \param wet_step wet gain increment per sample
+* \param width side gain relative to mid
+*/
+static void KERNEL(mix_out)(const float* input_l, const float* input_r,
+    const float* restrict wet_l, const float* restrict wet_r,
+    float* output_l, float* output_r, uint32_t n, float dry, float dry_step,
+    float wet, float wet_step, float width) {
+    for (uint32_t i = 0 ; i < n ; ++i) {
+        float d = dry + dry_step * (i + 1);
+        float w = wet + wet_step * (i + 1);
+        float mid = wet_l[i] * w;
+        float side = wet_r[i] * w * width;
+        output_l[i] = input_l[i] * d + mid + side;
+        output_r[i] = input_r[i] * d + mid - side;
+    }
+}
+
+
+/**
+* Decodes the mid/side wet signal alone, the wet part of a mix.
+* \param wet_l wet mid signal
+* \param wet_r wet side signal
+* \param out_l left output
+* \param out_r right output
+* \param n number of samples
+* \param wet wet gain before the first sample
+* \param wet_step wet gain increment per sample
+* \param width side gain relative to mid
+*/
+static void KERNEL(mix_wet)(const float* restrict wet_l,
+    const float* restrict wet_r, float* out_l, float* out_r, uint32_t n,
+    float wet, float wet_step, float width) {
+    for (uint32_t i = 0 ; i < n ; ++i) {
+        float w = wet + wet_step * (i + 1);
+        float mid = wet_l[i] * w;
+        float side = wet_r[i] * w * width;
+        out_l[i] = mid + side;
+        out_r[i] = mid - side;
+    }
+}
+
+
+/**
+* Dispatch table of this copy.
+*/
+static const Kernels KERNEL(kernels) = {
+    KERNEL_NAME,
+    KERNEL(add_grain),
+    KERNEL(add_pitched_grain),
+    KERNEL(decode_bands),
+    KERNEL(measure),
+    KERNEL(compact),
+    KERNEL(correlate),
+    KERNEL(sampler_segment),
+    KERNEL(biquad_stage),
+    KERNEL(ramp),
+    KERNEL(phase_ramp),
+    KERNEL(sustain_segment),
+    KERNEL(pass_dry),
+    KERNEL(mix_out),
+    KERNEL(mix_wet),
+};
@@ -24,21 +24,78 @@
 * \brief An LV2 sound retainer
 */
 
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <sys/time.h>
+#include <time.h>
+#if defined(__arm__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
 
 #include "lv2/lv2plug.in/ns/lv2core/lv2.h"
+#include "lv2/lv2plug.in/ns/ext/atom/atom.h"
+#include "lv2/lv2plug.in/ns/ext/atom/util.h"
+#include "lv2/lv2plug.in/ns/ext/midi/midi.h"
+#include "lv2/lv2plug.in/ns/ext/time/time.h"
+#include "lv2/lv2plug.in/ns/ext/urid/urid.h"
+#include "lv2/lv2plug.in/ns/ext/worker/worker.h"
+
+#include "bollie-retain.h"
 
-#define URI "https://ca9.eu/lv2/bollieretain"
 
 #define MAX_TAPE_LEN 192000
+#define HISTORY_LEN 8       ///< Maximum number of loops kept for undo
+#define TAPE_PAD 4          ///< Silence after each loop for interpolation
+#define BOUNCE_GRAINS 128   ///< Maximum number of grains of a bounced loop
+#define BOUNCE_MAX_LOOPS 4  ///< Longest bounced loop in capture lengths
 
+#define MATCH_FFT_LEN 8192  ///< FFT size used by the seam search
+#define MATCH_LEN 1024      ///< Length of the compared waveform segments
+#define MATCH_THRESHOLD 0.9f ///< Correlation needed for a short seam
 
-/**
-* Make a bool type available. ;)
-*/
-typedef enum { false, true } bool;
+#define ZC_WINDOW_LEN 2048  ///< Maximum zero crossing search window
+#define ZC_THRESHOLD 0.02f  ///< Level sum below which a crossing is clean
+#define ZC_NONE 1e30f       ///< Score of samples without a crossing
+
+#define CONTROL_LEN 32      ///< Samples per control-rate sub-block
+#define GRAIN_POOL_LEN 16   ///< Maximum number of simultaneous grains
+#define GRAIN_MAX_LEN 16384 ///< Maximum grain length
+#define WSOLA_STRIDE 4      ///< Decimation of the WSOLA similarity measure
+#define MAX_STRETCH 16.0f   ///< Maximum time stretch factor
+#define SUSTAIN_VOICES 4    ///< Number of staggered tape copies to sustain
+#define SCATTER_PITCH 7.0f  ///< Maximum grain pitch jitter in semitones
+#define RNG_LANES 4         ///< Independent xorshift generators
+#define RANDOM_BATCH 16     ///< Random numbers generated at once
+
+#define SAMPLER_VOICES 16   ///< Size of the sampler voice pool
+#define SAMPLER_ROOT 60     ///< MIDI note playing the tape unpitched
+#define STEAL_MS 5.0f       ///< Fade out of a stolen sampler voice
+
+#define FILTER_STAGES 2     ///< Biquads in the wet filter cascade
+#define FILTER_SMOOTH 0.2f  ///< Control smoothing per sub-block
+#define MIX_SMOOTH 0.99f    ///< Dry and wet gain smoothing per sample
+#define WRAP_PULSE_MS 10.0f ///< Length of the loop wrap trigger pulse
+
+#define COMPACT_RANGE 2.0f      ///< Largest level on the compact tapes
+#define COMPACT_SCALE (32767.0f / COMPACT_RANGE)    ///< Compact tape scale
+#define BAND_TAPES 4            ///< Low and high band tapes of both sides
+
+#define NORMALIZE_RMS 0.125f    ///< Loop level after normalization, -18 dBFS
+#define NORMALIZE_MAX 15.85f    ///< Maximum makeup gain, +24 dB
+
+#define GOVERNOR_DEGRADE 1.0f   ///< Smoothed budget use stepping down
+#define GOVERNOR_RECOVER 0.5f   ///< Smoothed budget use stepping back up
+#define GOVERNOR_SMOOTH 0.1f    ///< Budget use smoothing per block
+#define GOVERNOR_LEVELS 3       ///< Maximum tiers below the selected one
+
+#define RECORD_RING_LEN 65536   ///< Recorder ring size in bytes, power of 2
+#define RECORD_MAX_LEN 264      ///< Longest record in bytes
 
 
 /**
@@ -51,11 +108,243 @@ typedef enum {
     BRT_INPUT_R     = 3,
     BRT_OUTPUT_L    = 4,
     BRT_OUTPUT_R    = 5,
+    BRT_SEAM        = 6,
+    BRT_MODE        = 7,
+    BRT_STRETCH     = 8,
+    BRT_SCATTER     = 9,
+    BRT_CONTROL     = 10,
+    BRT_ATTACK      = 11,
+    BRT_DECAY       = 12,
+    BRT_SUSTAIN     = 13,
+    BRT_RELEASE     = 14,
+    BRT_FILTER      = 15,
+    BRT_FILTER_FREQ = 16,
+    BRT_TILT        = 17,
+    BRT_BANDS       = 18,
+    BRT_CROSSOVER   = 19,
+    BRT_LOW         = 20,
+    BRT_HIGH        = 21,
+    BRT_WIDTH       = 22,
+    BRT_NORMALIZE   = 23,
+    BRT_QUALITY     = 24,
+    BRT_FREEWHEEL   = 25,
+    BRT_CPU_BUDGET  = 26,
+    BRT_HOLD        = 27,
+    BRT_HOLD_RELEASE = 28,
+    BRT_PHASE       = 29,
+    BRT_WRAP        = 30,
+    BRT_DUCK        = 31,
+    BRT_DUCK_THRESHOLD = 32,
+    BRT_DUCK_ATTACK = 33,
+    BRT_DUCK_RELEASE = 34,
+    BRT_KEY_L       = 35,
+    BRT_KEY_R       = 36,
+    BRT_WINDOW_START = 37,
+    BRT_WINDOW_END  = 38,
+    BRT_SYNC        = 39,
+    BRT_WET_L       = 40,   // Split variant only, its ports come last
+    BRT_WET_R       = 41,
+    BRT_DRY_L       = 42,
+    BRT_DRY_R       = 43,
+    BRT_N_PORTS
 } PortIdx;
 
 
+/**
+* Enumeration of playback modes
+*/
+typedef enum {
+    MODE_LOOP       = 0,        ///< Plays the tape verbatim
+    MODE_STRETCH    = 1,        ///< Granular time stretch, keeps the pitch
+    MODE_SUSTAIN    = 2,        ///< Staggered decorrelated copies, no seam
+    MODE_SAMPLER    = 3,        ///< Tape played chromatically by MIDI notes
+} PlayMode;
+
+
+/**
+* Enumeration of wet filter types
+*/
+typedef enum {
+    FILTER_OFF      = 0,
+    FILTER_LOWPASS  = 1,        ///< 4th order Butterworth low pass
+    FILTER_HIGHPASS = 2,        ///< 4th order Butterworth high pass
+    FILTER_TILT     = 3,        ///< Opposed low and high shelves
+} FilterType;
+
+
+/**
+* Left and right sample processed together as one vector
+*/
+typedef float stereo_t __attribute__((vector_size(2 * sizeof(float))));
+
+
+/**
+* One sample of all sustain voices of one side as one vector
+*/
+typedef float voices_t
+    __attribute__((vector_size(SUSTAIN_VOICES * sizeof(float))));
+
+
+/**
+* Normalized biquad coefficients
+*/
+typedef struct {
+    float b0;
+    float b1;
+    float b2;
+    float a1;
+    float a2;
+} Biquad;
+
+
+/**
+* Enumeration of sampler envelope stages
+*/
+typedef enum {
+    STAGE_OFF       = 0,
+    STAGE_ATTACK    = 1,
+    STAGE_DECAY     = 2,
+    STAGE_SUSTAIN   = 3,
+    STAGE_RELEASE   = 4,
+    STAGE_STEAL     = 5,        ///< Fading out, the next note waits
+} EnvStage;
+
+
+/**
+* Enumeration of seam modes
+*/
+typedef enum {
+    SEAM_CROSSFADE  = 0,        ///< Fixed crossfade at the nominal loop end
+    SEAM_MATCH      = 1,        ///< Loop end picked by waveform correlation
+    SEAM_ZERO_CROSSING = 2,     ///< Loop boundaries snapped to zero crossings
+} SeamMode;
+
+
+/**
+* Enumeration of quality tiers
+*/
+typedef enum {
+    QUALITY_ECONOMY  = 0,       ///< Lightest kernels for crowded boards
+    QUALITY_STANDARD = 1,       ///< Default trade off
+    QUALITY_HIGH     = 2,       ///< Best kernels, used while freewheeling
+} Quality;
+
+
+/**
+* Kernel choices of a quality tier
+*/
+typedef struct {
+    int wsola_step;             ///< Spacing of the grain search, 0 for none
+    int wsola_stride;           ///< Sample spacing of the grain similarity
+    int cubic;                  ///< 4 point Hermite instead of linear reads
+    int smooth_seam;            ///< S-curve seam crossfade instead of linear
+} Tier;
+
+/**
+* Tiers from cheapest to best, a Quality is found one entry up. The first
+* one is left to the governor, grains are placed without alignment there.
+*/
+static const Tier tiers[] = {
+    { 0, 0, false, false },
+    { 4, 2 * WSOLA_STRIDE, false, false },
+    { 2, WSOLA_STRIDE, false, false },
+    { 1, 1, true, true },
+};
+
+
+/**
+* Enumeration of worker jobs, every job message starts with its type
+*/
+typedef enum {
+    JOB_SEAM        = 0,        ///< Seam search, see SeamJob
+    JOB_FLUSH       = 1,        ///< Write out the recorder ring
+    JOB_BOUNCE      = 2,        ///< Loop re-length, see BounceJob
+    JOB_BANDS       = 3,        ///< Band tape allocation, see BandJob
+    JOB_FREE        = 4,        ///< Own tapes to free, see FreeJob
+} JobType;
+
+
+/**
+* Band tape allocation, the worker answers with the tapes.
+*/
+typedef struct {
+    JobType type;               ///< Always JOB_BANDS
+    int16_t* tapes;             ///< BAND_TAPES arenas, NULL if out of memory
+} BandJob;
+
+
+/**
+* Own tapes of a loop run() let go of, the worker frees them.
+*/
+typedef struct {
+    JobType type;               ///< Always JOB_FREE
+    float* tape;                ///< Tapes to free
+} FreeJob;
+
+
+/**
+* Seam search job, passed from run() to the worker and back.
+*/
+typedef struct {
+    JobType type;               ///< Always JOB_SEAM
+    int generation;             ///< Capture the job belongs to
+    int region;                 ///< Arena region of the capture
+    int loop_end;               ///< Resulting loop end
+    int n_seam_samples;         ///< Resulting crossfade length
+} SeamJob;
+
+
+/**
+* Loop parameters of a tape slot in the history. The audio stays in its
+* slot, switching loops only swaps these and the tape pointers. A loop
+* bounced longer than a slot gets its own tapes from the worker, mid and
+* side followed by the band tapes, if the loop has bands.
+*/
+typedef struct {
+    int loop_start;             ///< Loop start after the preroll
+    int loop_end;               ///< Loop end
+    int n_seam_samples;         ///< Crossfade length at the seam
+    float makeup_gain;          ///< Gain normalizing the loop
+    int bands_captured;         ///< The band tapes hold the loop
+    float bpm;                  ///< Tempo the loop length belongs to, or 0
+    float* tape;                ///< Own tapes of a loop outgrowing its slot
+    int tape_len;               ///< Samples per own tape
+} Take;
+
+
+/**
+* Bounce job, passed from run() to the worker and back. The worker
+* stretches the loop to the new length into the target region, or into
+* own tapes of the loop if the target is -1.
+*/
+typedef struct {
+    JobType type;               ///< Always JOB_BOUNCE
+    int generation;             ///< Loop the job belongs to
+    int source;                 ///< Arena region of the loop
+    int target;                 ///< Arena region to write to, or -1
+    int length;                 ///< New loop length
+    int n_grains;               ///< Grains placed, 0 if none, see bounce_pos
+    Take take;                  ///< Loop parameters, bounced ones on return
+} BounceJob;
+
+
+/**
+* Per sub-block scratch signals. Instances own one for run(), a batch
+* shares one per thread.
+*/
+typedef struct {
+    float wet_l[CONTROL_LEN];   ///< Rendered wet signal mid
+    float wet_r[CONTROL_LEN];   ///< Rendered wet signal side
+    float scratch_l[CONTROL_LEN];   ///< Intermediate signal left
+    float scratch_r[CONTROL_LEN];   ///< Intermediate signal right
+    float held_l[CONTROL_LEN];  ///< Input span kept for the split outputs
+    float held_r[CONTROL_LEN];  ///< Input span kept for the split outputs
+} Scratch;
+
+
 /**
 * Struct for THE BollieRetain instance, the host is going to use.
+* State used every block comes first, so a batch can prefetch it.
 */
 typedef struct {
     const float* ctl_blend;     ///< Tempo in BPM from host
@@ -64,11 +353,79 @@ typedef struct {
     const float* input_r;       ///< input1, right side
     float* output_l;            ///< output1, left side
     float* output_r;            ///< output2, right side
+    const float* ctl_seam;      ///< Seam mode, see SeamMode
+    const float* ctl_mode;      ///< Playback mode, see PlayMode
+    const float* ctl_stretch;   ///< Time stretch factor
+    const float* ctl_scatter;   ///< Grain scatter amount in percent
+    const LV2_Atom_Sequence* control; ///< Incoming MIDI
+    const float* ctl_attack;    ///< Sampler attack time in ms
+    const float* ctl_decay;     ///< Sampler decay time in ms
+    const float* ctl_sustain;   ///< Sampler sustain level in percent
+    const float* ctl_release;   ///< Sampler release time in ms
+    const float* ctl_filter;    ///< Wet filter type, see FilterType
+    const float* ctl_filter_freq;   ///< Wet filter frequency in Hz
+    const float* ctl_tilt;      ///< Wet filter tilt in dB
+    const float* ctl_bands;     ///< Capture band tapes and play them
+    const float* ctl_crossover; ///< Band crossover frequency in Hz
+    const float* ctl_low;       ///< Low band level in percent
+    const float* ctl_high;      ///< High band level in percent
+    const float* ctl_width;     ///< Stereo width of the wet signal in percent
+    const float* ctl_normalize; ///< Apply the makeup gain of the loop
+    const float* ctl_quality;   ///< Quality tier, see Quality
+    const float* ctl_freewheel; ///< Host renders faster than real time
+    const float* ctl_cpu_budget;    ///< Governor budget in percent, 0 off
+    const float* ctl_hold;      ///< Momentary hold footswitch
+    const float* ctl_hold_release;  ///< Fade out after a hold in ms
+    float* cv_phase;            ///< Loop phase CV, NULL if not connected
+    float* cv_wrap;             ///< Loop wrap trigger CV, NULL if unused
+    float* wet_out_l;           ///< Split variant wet output, left side
+    float* wet_out_r;           ///< Split variant wet output, right side
+    float* dry_out_l;           ///< Split variant dry output, left side
+    float* dry_out_r;           ///< Split variant dry output, right side
+    const float* ctl_duck;      ///< Ducking depth in dB, 0 off
+    const float* ctl_duck_threshold;    ///< Key level ducking starts at
+    const float* ctl_duck_attack;   ///< Ducking attack time in ms
+    const float* ctl_duck_release;  ///< Ducking release time in ms
+    const float* key_l;         ///< Ducking key, left side, NULL for input
+    const float* key_r;         ///< Ducking key, right side, NULL for left
+    const float* ctl_window_start;  ///< Loop window start in percent
+    const float* ctl_window_end;    ///< Loop window end in percent
+    const float* ctl_sync;      ///< Bounce the loop on host tempo changes
+
+    LV2_Worker_Schedule* schedule; ///< Worker feature, NULL if unsupported
+    LV2_URID midi_event;        ///< URID of midi:MidiEvent
+    LV2_URID atom_object;       ///< URID of atom:Object
+    LV2_URID atom_blank;        ///< URID of atom:Blank
+    LV2_URID msg_undo;          ///< URID of the undo message
+    LV2_URID msg_redo;          ///< URID of the redo message
+    LV2_URID atom_float;        ///< URID of atom:Float
+    LV2_URID time_position;     ///< URID of time:Position
+    LV2_URID time_bpm;          ///< URID of time:beatsPerMinute
 
     double rate;                ///< Current sample rate
 
     int n_loop_samples;         ///< Numbers of samples for the loop
     int n_fade_samples;         ///< Numbers of samples for fade
+    int n_pulse_samples;        ///< Length of the wrap trigger pulse
+    int n_short_seam_samples;   ///< Crossfade length for matched seams
+    int n_zc_samples;           ///< Zero crossing search range per side
+    int n_grain_samples;        ///< Grain length, even
+    int n_wsola_samples;        ///< WSOLA search range per side
+
+    int loop_start;             ///< Window start, the preroll leads to it
+    int loop_end;               ///< Window end, the seam is right before it
+    int n_seam_samples;         ///< Current crossfade length at the seam
+
+    int generation;             ///< Incremented with every finished capture
+    int seam_pending;           ///< A seam job result waits for the wrap
+    int pending_loop_end;       ///< Loop end to apply at the next wrap
+    int pending_n_seam_samples; ///< Crossfade length to apply at next wrap
+
+    float host_bpm;             ///< Host tempo, 0 until the host sends one
+    int bounce_busy;            ///< A bounce job is on its way
+    int bounce_pending;         ///< A bounced loop waits for the wrap
+    Take bounce_take;           ///< Loop parameters of the bounced loop
+    int bounce_n_grains;        ///< Grains of the bounced loop
 
     int pos_w;                  ///< Write position
     int pos_r;                  ///< Read position
@@ -78,220 +435,3472 @@ typedef struct {
 
     float dry_gain;             ///< State leading towards target dry gain
     float wet_gain;             ///< State leading towards target dry gain
+    float width;                ///< Smoothed wet stereo width
+    float blend;                ///< Blend the gains below belong to
+    float blend_dry_gain;       ///< Dry gain of the blend control
+    float blend_wet_gain;       ///< Wet gain of the blend control
+    float target_dry_gain;      ///< Dry gain to smooth towards
+    float target_wet_gain;      ///< Wet gain to smooth towards
+    float mix_decay;            ///< Gain smoothing over a whole sub-block
+    int held;                   ///< Hold switch state of the last sub-block
+    int releasing;              ///< Fading out after the hold was let go
+    float hold_gain;            ///< Hold envelope, scales the wet signal
+    float hold_step;            ///< Hold envelope change per sample
+    float clock_phase;          ///< Last loop phase output, -1 if stopped
+    float duck_env;             ///< Ducking key power envelope
+    float duck_controls[4];     ///< Ducking controls the values below are for
+    float duck_floor;           ///< Wet gain at full ducking depth
+    float duck_threshold;       ///< Key power ducking starts at
+    float duck_attack;          ///< Envelope attack over a whole sub-block
+    float duck_release;         ///< Envelope release over a whole sub-block
+    int pulse_countdown;        ///< Samples left of the wrap trigger pulse
 
-    float buffer_l[MAX_TAPE_LEN];   ///< delay buffer left
-    float buffer_r[MAX_TAPE_LEN];   ///< delay buffer right
+    double capture_energy;      ///< Sum of squares of the capture so far
+    float capture_peak;         ///< Peak level of the capture so far
+    float makeup_gain;          ///< Gain normalizing the captured loop
+
+    PlayMode mode;              ///< Playback mode of the running loop
+    const Tier* tier;           ///< Kernels of the current block
+    const struct Kernels* kernels;  ///< Kernel variant for this CPU
+    int governor_level;         ///< Tiers the governor stepped down
+    float governor_load;        ///< Smoothed share of the budget used
+    int governor_hold;          ///< Samples until the governor may step
+
+    double grain_pos;           ///< Virtual read position when stretching
+    int grain_countdown;        ///< Samples until the next grain starts
+    int grain_last_src;         ///< Tape position of the latest grain or -1
+    int n_grains;               ///< Number of active grains
+    int grain_src[GRAIN_POOL_LEN];      ///< Tape position of each grain
+    int grain_phase[GRAIN_POOL_LEN];    ///< Progress of each grain
+    float grain_rate[GRAIN_POOL_LEN];   ///< Playback speed of each grain
+    float grain_pan_a[GRAIN_POOL_LEN];  ///< Mid/side pan matrix diagonal
+    float grain_pan_b[GRAIN_POOL_LEN];  ///< Mid/side pan matrix off diagonal
+    float scatter;              ///< Scatter amount of the current block, 0-1
+
+    uint32_t note_counter;      ///< Incremented with every note on
+    int n_voices;               ///< Number of voices not off
+    int voice_note[SAMPLER_VOICES];     ///< MIDI note of each voice
+    uint32_t voice_age[SAMPLER_VOICES]; ///< note_counter at note on
+    EnvStage voice_stage[SAMPLER_VOICES];   ///< Envelope stage
+    float voice_env[SAMPLER_VOICES];    ///< Envelope level
+    float voice_velocity[SAMPLER_VOICES];   ///< Velocity gain
+    float voice_gain[SAMPLER_VOICES];   ///< Output gain, env * velocity
+    float voice_gain_step[SAMPLER_VOICES];  ///< Gain ramp per sample
+    float voice_pos[SAMPLER_VOICES];    ///< Tape position
+    float voice_rate[SAMPLER_VOICES];   ///< Tape speed
+    float voice_next_velocity[SAMPLER_VOICES];  ///< Next note velocity
+    float voice_next_rate[SAMPLER_VOICES];      ///< Next note tape speed
+
+    FilterType filter_type;     ///< Filter type the targets are made for
+    float filter_freq;          ///< Frequency the targets are made for
+    float filter_tilt;          ///< Tilt the targets are made for
+    Biquad filter_target[FILTER_STAGES];    ///< Coefficients to smooth to
+    Biquad filter_coeff[FILTER_STAGES];     ///< Coefficients in use
+    stereo_t filter_z1[FILTER_STAGES];      ///< First state of each stage
+    stereo_t filter_z2[FILTER_STAGES];      ///< Second state of each stage
+
+    int bands_captured;         ///< The band tapes hold the current loop
+    int bands_active;           ///< The loop is played from the band tapes
+    float band_gain_low;        ///< Smoothed low band level
+    float band_gain_high;       ///< Smoothed high band level
+    Biquad xover_low;           ///< Crossover low pass section
+    Biquad xover_high;          ///< Crossover high pass section
+    stereo_t xover_z1[4];       ///< Crossover first states, low then high
+    stereo_t xover_z2[4];       ///< Crossover second states, low then high
+
+    uint32_t rng_state[RNG_LANES];      ///< xorshift32 generator states
+    float random[RANDOM_BATCH]; ///< Batch of random numbers in [-1, 1)
+    int n_random;               ///< Unused random numbers left in the batch
+
+    float sustain_gain;         ///< Fade in and out of the sustain voices
+    float sustain_norm;         ///< Level compensation of the voice sum
+    int sustain_pos[SUSTAIN_VOICES];        ///< Tape position of each voice
+    voices_t sustain_coeff[2];  ///< Allpass coefficients, mid then side
+    voices_t sustain_x1[2];     ///< Allpass input states, mid then side
+    voices_t sustain_y1[2];     ///< Allpass output states, mid then side
+
+    FILE* record_file;          ///< Control input recording, NULL if off
+    uint8_t* record_ring;       ///< Records waiting for the worker
+    uint32_t record_head;       ///< Bytes written, owned by run()
+    uint32_t record_tail;       ///< Bytes flushed, owned by the worker
+    uint32_t record_dropped;    ///< Records lost to a full ring
+    int record_flush_pending;   ///< A flush job is on its way
+    int record_all;             ///< Next block records every control
+    const float* record_port[BRT_N_PORTS];  ///< Control ports by index
+    float record_value[BRT_N_PORTS];        ///< Last recorded values
+
+    float* wet_l;               ///< Rendered wet signal mid
+    float* wet_r;               ///< Rendered wet signal side
+    float* scratch_l;           ///< Intermediate signal left
+    float* scratch_r;           ///< Intermediate signal right
+    float* held_l;              ///< Input span kept for the split outputs
+    float* held_r;              ///< Input span kept for the split outputs
+    Scratch own_scratch;        ///< Scratch signals used by run()
+
+    float* buffer_l;            ///< tape left, mid once captured
+    float* buffer_r;            ///< tape right, side once captured
+    int16_t* band_low_l;        ///< low band tape left
+    int16_t* band_low_r;        ///< low band tape right
+    int16_t* band_high_l;       ///< high band tape left
+    int16_t* band_high_r;       ///< high band tape right
+
+    Take takes[HISTORY_LEN];    ///< Loop parameters per slot
+    int region[HISTORY_LEN];    ///< Arena region holding each slot
+    int spare_region;           ///< Region free for a bounce, or -1
+    int slot_len;               ///< Arena samples per slot
+    int tape_len;               ///< Samples of the tapes in use
+    float* retired[HISTORY_LEN + 2];    ///< Own tapes for the worker to free
+    int n_retired;              ///< Own tapes waiting to be freed
+    int n_slots;                ///< Slots fitting in the arena
+    int take;                   ///< Slot of the latest loop played
+    int has_take;               ///< The take slot holds a finished loop
+    int n_undo;                 ///< Older loops kept behind the take
+    int n_redo;                 ///< Undone loops kept after the take
+
+    float arena_l[MAX_TAPE_LEN];    ///< Tape slots left
+    float arena_r[MAX_TAPE_LEN];    ///< Tape slots right
+    int16_t* band_arena;        ///< Band tape slots, NULL until bands are used
+    int band_arena_requested;   ///< The worker was asked for band tapes
+
+    float zc_score[ZC_WINDOW_LEN];  ///< zero crossing scores of a window
+
+    float hann[GRAIN_MAX_LEN];      ///< Grain window, n_grain_samples long
+
+    float twiddle_re[MATCH_FFT_LEN / 2];    ///< FFT twiddles, real part
+    float twiddle_im[MATCH_FFT_LEN / 2];    ///< FFT twiddles, imaginary part
+    float fft_re[MATCH_FFT_LEN];    ///< worker scratch, packed spectrum
+    float fft_im[MATCH_FFT_LEN];    ///< worker scratch, packed spectrum
+    float xcorr_re[MATCH_FFT_LEN];  ///< worker scratch, cross spectrum
+    float xcorr_im[MATCH_FFT_LEN];  ///< worker scratch, cross spectrum
+    float* bounce_src;          ///< worker scratch, NULL until a bounce
+    float* bounce_acc;          ///< worker scratch, grain sum
+    float* bounce_norm;         ///< worker scratch, window sum
+    int bounce_pos[BOUNCE_GRAINS];      ///< worker scratch, grain sources
 
 } BollieRetain;
 
 
 /**
-* Instantiates the plugin
-* Allocates memory for the BollieRetain object and returns a pointer as
-* LV2Handle.
+* Hot loops of one instruction set variant, see bollie-retain-kernels.h
 */
-static LV2_Handle instantiate(const LV2_Descriptor * descriptor, double rate,
-    const char* bundle_path, const LV2_Feature* const* features) {
-    
-    BollieRetain *self = (BollieRetain*)calloc(1, sizeof(BollieRetain));
+typedef struct Kernels {
+    const char* name;           ///< Variant name, as in BOLLIERETAIN_ISA
+    void (*add_grain)(float* restrict, float* restrict,
+        const float* restrict, const float* restrict, const float* restrict,
+        float, float, int);
+    void (*add_pitched_grain)(float* restrict, float* restrict,
+        const float* restrict, const float* restrict, int, int, float,
+        const float* restrict, float, float, int, int);
+    void (*decode_bands)(const int16_t* restrict, const int16_t* restrict,
+        const int16_t* restrict, const int16_t* restrict, float, float,
+        float* restrict, float* restrict, uint32_t);
+    void (*measure)(const float* restrict, const float* restrict, uint32_t,
+        double*, float*);
+    void (*compact)(const float* restrict, int16_t* restrict, uint32_t);
+    float (*correlate)(const float* restrict, const float* restrict, int,
+        int);
+    void (*sampler_segment)(BollieRetain*, float* restrict, float* restrict,
+        uint32_t);
+    void (*biquad_stage)(const Biquad*, stereo_t*, stereo_t*, const float*,
+        const float*, float*, float*, uint32_t);
+    void (*ramp)(float* restrict, float* restrict, uint32_t, float, float);
+    void (*phase_ramp)(float* restrict, float, float, uint32_t);
+    uint32_t (*sustain_segment)(BollieRetain*, float* restrict,
+        float* restrict, uint32_t);
+    void (*pass_dry)(const float*, const float*, float*, float*, uint32_t,
+        float, float);
+    void (*mix_out)(const float*, const float*, const float* restrict,
+        const float* restrict, float*, float*, uint32_t, float, float, float,
+        float, float);
+    void (*mix_wet)(const float* restrict, const float* restrict, float*,
+        float*, uint32_t, float, float, float);
+} Kernels;
 
-    // Memorize sample rate for calculation
-    self->rate = rate;
-    self->n_fade_samples = ceil(0.05f * rate);
-    self->n_loop_samples = ceil(0.5f * rate);
 
-    return (LV2_Handle)self;
+/**
+* Points the scratch signals of an instance to a scratch buffer.
+* \param self current plugin instance
+* \param scratch buffer to use from now on
+*/
+static void use_scratch(BollieRetain* self, Scratch* scratch) {
+    self->wet_l = scratch->wet_l;
+    self->wet_r = scratch->wet_r;
+    self->scratch_l = scratch->scratch_l;
+    self->scratch_r = scratch->scratch_r;
+    self->held_l = scratch->held_l;
+    self->held_r = scratch->held_r;
 }
 
 
 /**
-* Used by the host to connect the ports of this plugin.
-* \param instance current LV2_Handle (will be cast to BollieRetain*)
-* \param port LV2 port index, maches the enum above.
-* \param data Pointer to the actual port data.
+* Starts recording the control input, if BOLLIERETAIN_RECORD is set.
+* The file is written by the worker, so recording needs it.
+* \param self current plugin instance
+* \param rate sample rate, part of the file header
 */
-static void connect_port(LV2_Handle instance, uint32_t port, void *data) {
-    BollieRetain *self = (BollieRetain*)instance;
+static void open_recording(BollieRetain* self, double rate) {
+    static uint32_t n_recordings;
+    const char* path = getenv(BOLLIERETAIN_RECORD_ENV);
 
-    switch ((PortIdx)port) {
-        case BRT_BLEND:
-            self->ctl_blend = data;
-            break;
-        case BRT_TRIGGER:
-            self->ctl_trigger = data;
-            break;
-        case BRT_INPUT_L:
-            self->input_l = data;
-            break;
-        case BRT_INPUT_R:
-            self->input_r = data;
-            break;
-        case BRT_OUTPUT_L:
-            self->output_l = data;
-            break;
-        case BRT_OUTPUT_R:
-            self->output_r = data;
-            break;
+    if (!path || !*path || !self->schedule) {
+        return;
+    }
+
+    char* name = malloc(strlen(path) + 12);
+    sprintf(name, "%s.%u", path,
+        __atomic_fetch_add(&n_recordings, 1, __ATOMIC_RELAXED));
+    self->record_file = fopen(name, "wb");
+    self->record_ring = malloc(RECORD_RING_LEN);
+    free(name);
+
+    if (!self->record_file || !self->record_ring) {
+        if (self->record_file) {
+            fclose(self->record_file);
+        }
+        free(self->record_ring);
+        self->record_file = NULL;
+        self->record_ring = NULL;
+        return;
     }
+    fwrite(BOLLIERETAIN_RECORD_MAGIC, 4, 1, self->record_file);
+    fwrite(&rate, sizeof(double), 1, self->record_file);
 }
-    
+
 
 /**
-* This has to reset all the internal states of the plugin
-* \param instance pointer to current plugin instance
+* Audio thread side of the recorder ring, adds one record. Records that
+* don't fit are counted and the count is recorded once there is room.
+* \param self current plugin instance
+* \param data tag and payload
+* \param size record length
 */
-static void activate(LV2_Handle instance) {
-    BollieRetain* self = (BollieRetain*)instance;
-    // Let's remove all that noise
-    for (int i = 0 ; i < MAX_TAPE_LEN ; ++i) {
-        self->buffer_l[i] = 0;
-        self->buffer_r[i] = 0;
+static void record(BollieRetain* self, const uint8_t* data, uint32_t size) {
+    uint8_t dropped[5] = { BOLLIERETAIN_RECORD_DROPPED };
+    uint32_t head = self->record_head;
+    uint32_t tail = __atomic_load_n(&self->record_tail, __ATOMIC_ACQUIRE);
+
+    if (self->record_dropped) {
+        if (RECORD_RING_LEN - (head - tail) < sizeof(dropped) + size) {
+            self->record_dropped++;
+            return;
+        }
+        memcpy(dropped + 1, &self->record_dropped, sizeof(uint32_t));
+        self->record_dropped = 0;
+        record(self, dropped, sizeof(dropped));
+        head = self->record_head;
+    }
+    if (RECORD_RING_LEN - (head - tail) < size) {
+        self->record_dropped++;
+        return;
     }
 
-    // Reset state variables
-    self->pos_r = 0;
-    self->pos_w = 0;
-    self->dry_gain = 0;
-    self->wet_gain = 0;
-    self->listening = false;
-    self->looping = true;
+    uint32_t index = head & (RECORD_RING_LEN - 1);
+    uint32_t first = RECORD_RING_LEN - index < size
+        ? RECORD_RING_LEN - index : size;
+    memcpy(self->record_ring + index, data, first);
+    memcpy(self->record_ring, data + first, size - first);
+    __atomic_store_n(&self->record_head, head + size, __ATOMIC_RELEASE);
 }
 
+
 /**
-* Main process function of the plugin.
-* \param instance  handle of the current plugin
-* \param n_samples number of samples in this current input block.
+* Reads the tempo of a time:Position object.
+* \param self current plugin instance
+* \param obj the object
+* \return tempo in BPM, 0 if it isn't a position with a tempo
 */
-static void run(LV2_Handle instance, uint32_t n_samples) {
-    BollieRetain* self = (BollieRetain*)instance;
+static float position_bpm(const BollieRetain* self,
+    const LV2_Atom_Object* obj) {
+    const LV2_Atom* bpm = NULL;
 
-    float dry_gain = self->dry_gain;
-    float wet_gain = self->wet_gain;
-    int pos_w = self->pos_w;
-    int pos_r = self->pos_r;
-    int n_fade_samples = self->n_fade_samples;
-    int n_loop_samples = self->n_loop_samples;
-    int listening = self->listening;
-    int looping = self->looping;
-    float ctl_blend = *self->ctl_blend;
+    if (obj->body.otype != self->time_position) {
+        return 0;
+    }
+    lv2_atom_object_get(obj, self->time_bpm, &bpm, 0);
+    if (!bpm || bpm->type != self->atom_float) {
+        return 0;
+    }
+    return ((const LV2_Atom_Float*)bpm)->body;
+}
 
-    // Now listen
-    if (*(self->ctl_trigger) > 0 && !listening) {
-        listening = true;
+
+/**
+* Records the control changes and MIDI events of a block, then the block.
+* \param self current plugin instance
+* \param n_samples block length
+*/
+static void record_block(BollieRetain* self, uint32_t n_samples) {
+    uint8_t rec[RECORD_MAX_LEN];
+
+    for (uint32_t p = 0 ; p < BRT_N_PORTS ; ++p) {
+        const float* port = self->record_port[p];
+        if (port && (self->record_all || *port != self->record_value[p])) {
+            rec[0] = BOLLIERETAIN_RECORD_CONTROL;
+            rec[1] = p;
+            memcpy(rec + 2, port, sizeof(float));
+            record(self, rec, 2 + sizeof(float));
+            self->record_value[p] = *port;
+        }
     }
-    
-    // Gain calculation
-    float target_dry_gain = 1;
-    float target_wet_gain = 0;
-    if (ctl_blend > 0 && ctl_blend < 50) {
-        target_wet_gain = powf(10.0f, (ctl_blend-50) * 0.04f);
-    }
-    else if (ctl_blend < 100 && ctl_blend > 50) {
-        target_wet_gain = 1;
-        target_dry_gain = powf(10.0f, (ctl_blend-50) * -0.04f);
-    }
-    else if (ctl_blend == 50) {
-        target_wet_gain = 1;
-    }
-    else if (ctl_blend == 100) {
-        target_wet_gain = 1;
-        target_dry_gain = 0;
-    }
-
-    // Loop over the block of audio we got
-    for (unsigned int i = 0 ; i < n_samples ; ++i) {
-        
-        // Paraemter smoothing for wet and dry gain
-        wet_gain = target_wet_gain * 0.01f + wet_gain * 0.99f;
-        dry_gain = target_dry_gain * 0.01f + dry_gain * 0.99f;
-
-        // Current samples
-        float cur_s_l = self->input_l[i];
-        float cur_s_r = self->input_r[i];
-        float wet_s_l = 0; // Wet sample left
-        float wet_s_r = 0; // Wet sample right
-        float coeff = 1.0f;
-        if (listening && !looping) {
-            if (pos_w < n_loop_samples) {
-                if (pos_w < n_fade_samples) {
-                    coeff = 1/n_fade_samples * pos_w;
-                }
-                else if (pos_w > n_loop_samples - n_fade_samples) {
-                    coeff = 1/n_fade_samples * (n_fade_samples - pos_w);
-                }
+    self->record_all = false;
 
-                self->buffer_l[pos_w] = cur_s_l * coeff;
-                self->buffer_r[pos_w++] = cur_s_r * coeff;;
-            }
-            else {
-                listening = false;
-                looping = true;
-            }
+    const LV2_Atom_Sequence* control = self->control;
+    for (const LV2_Atom_Event* ev = lv2_atom_sequence_begin(&control->body);
+        !lv2_atom_sequence_is_end(&control->body, control->atom.size, ev);
+        ev = lv2_atom_sequence_next(ev)) {
+        if (ev->body.type == self->midi_event && ev->body.size <= 255) {
+            uint32_t frames = ev->time.frames;
+            rec[0] = BOLLIERETAIN_RECORD_EVENT;
+            memcpy(rec + 1, &frames, sizeof(uint32_t));
+            rec[5] = ev->body.size;
+            memcpy(rec + 6, ev + 1, ev->body.size);
+            record(self, rec, 6 + ev->body.size);
         }
-        else if (looping) {
-            // buffer size - fade offset needs a crossfade
-            if (pos_r >= n_loop_samples - n_fade_samples && !listening) {
-                int p = pos_r - n_loop_samples - n_fade_samples; 
-                wet_s_l = self->buffer_l[pos_r] + self->buffer_l[p];
-                wet_s_r = self->buffer_r[pos_r] + self->buffer_r[p];
+        else if (ev->body.type == self->atom_object
+            || ev->body.type == self->atom_blank) {
+            const LV2_Atom_Object* obj = (const LV2_Atom_Object*)&ev->body;
+            if (obj->body.otype == self->msg_undo
+                || obj->body.otype == self->msg_redo) {
+                uint32_t frames = ev->time.frames;
+                rec[0] = BOLLIERETAIN_RECORD_HISTORY;
+                memcpy(rec + 1, &frames, sizeof(uint32_t));
+                rec[5] = obj->body.otype == self->msg_undo ? -1 : 1;
+                record(self, rec, 6);
             }
-            else {
-                // Simply copy
-                wet_s_l = self->buffer_l[pos_r];
-                wet_s_r = self->buffer_r[pos_r];
-            }
-            pos_r++;
-            // reset to fade offset at the end of the buffer
-            if (pos_r >= n_loop_samples) {
-                if (listening) {
-                    looping = false;
-                    pos_r = 0;
-                }
-                else {
-                    pos_r = n_fade_samples;
-                }
+            float bpm = position_bpm(self, obj);
+            if (bpm > 0) {
+                uint32_t frames = ev->time.frames;
+                rec[0] = BOLLIERETAIN_RECORD_TEMPO;
+                memcpy(rec + 1, &frames, sizeof(uint32_t));
+                memcpy(rec + 5, &bpm, sizeof(float));
+                record(self, rec, 5 + sizeof(float));
             }
         }
-        self->output_l[i] = cur_s_l * dry_gain +  wet_s_l * wet_gain;
-        self->output_r[i] = cur_s_r * dry_gain +  wet_s_r * wet_gain;
     }
-    self->pos_w = pos_w;
-    self->pos_r = pos_r;
-    self->dry_gain = dry_gain;
-    self->wet_gain = wet_gain;
-    self->looping = looping;
-    self->listening = listening;
+
+    rec[0] = BOLLIERETAIN_RECORD_BLOCK;
+    memcpy(rec + 1, &n_samples, sizeof(uint32_t));
+    record(self, rec, 1 + sizeof(uint32_t));
+
+    // The worker empties the ring once a quarter of it is used
+    uint32_t used = self->record_head
+        - __atomic_load_n(&self->record_tail, __ATOMIC_ACQUIRE);
+    if (used > RECORD_RING_LEN / 4
+        && !__atomic_load_n(&self->record_flush_pending, __ATOMIC_ACQUIRE)) {
+        JobType job = JOB_FLUSH;
+        self->record_flush_pending = true;
+        if (self->schedule->schedule_work(self->schedule->handle,
+            sizeof(job), &job) != LV2_WORKER_SUCCESS) {
+            self->record_flush_pending = false;
+        }
+    }
 }
 
 
 /**
-* Called, when the host deactivates the plugin.
+* Worker side of the recorder ring, writes everything recorded so far.
+* \param self current plugin instance
 */
-static void deactivate(LV2_Handle instance) {
+static void flush_recording(BollieRetain* self) {
+    uint32_t tail = self->record_tail;
+    uint32_t head = __atomic_load_n(&self->record_head, __ATOMIC_ACQUIRE);
+
+    while (tail != head) {
+        uint32_t index = tail & (RECORD_RING_LEN - 1);
+        uint32_t len = head - tail;
+        if (len > RECORD_RING_LEN - index) {
+            len = RECORD_RING_LEN - index;
+        }
+        fwrite(self->record_ring + index, 1, len, self->record_file);
+        tail += len;
+    }
+    fflush(self->record_file);
+    __atomic_store_n(&self->record_tail, tail, __ATOMIC_RELEASE);
+    __atomic_store_n(&self->record_flush_pending, false, __ATOMIC_RELEASE);
 }
 
 
 /**
-* Cleanup, freeing memory and stuff
+* Reads the tape between two samples with a 4 point Hermite curve.
+* \param x tape
+* \param k sample before the read position
+* \param f fraction between sample k and k + 1
+* \return interpolated sample
 */
-static void cleanup(LV2_Handle instance) {
-    free(instance);
+static inline float hermite(const float* x, int k, float f) {
+    float xm = x[k > 0 ? k - 1 : 0];
+    float x0 = x[k];
+    float x1 = x[k + 1];
+    float x2 = x[k + 2];
+    float c1 = 0.5f * (x1 - xm);
+    float c2 = xm - 2.5f * x0 + 2.0f * x1 - 0.5f * x2;
+    float c3 = 0.5f * (x2 - xm) + 1.5f * (x0 - x1);
+    return ((c3 * f + c2) * f + c1) * f + x0;
 }
 
 
+/*
+* Kernel variants. The plain build is the baseline of the target, SSE2 on
+* x86-64. GCC builds the same loops again for newer instruction sets, the
+* best one the CPU supports is picked once per instance.
+*/
+#define KERNEL(name) generic_##name
+#if defined(__ARM_NEON)
+#define KERNEL_NAME "neon"
+#elif defined(__x86_64__)
+#define KERNEL_NAME "sse2"
+#else
+#define KERNEL_NAME "generic"
+#endif
+#include "bollie-retain-kernels.h"
+#undef KERNEL
+#undef KERNEL_NAME
+
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__)
+#define KERNELS_X86
+
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#define KERNEL(name) avx2_##name
+#define KERNEL_NAME "avx2"
+#include "bollie-retain-kernels.h"
+#undef KERNEL
+#undef KERNEL_NAME
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512vl,avx512bw,avx512dq,avx2,fma")
+#define KERNEL(name) avx512_##name
+#define KERNEL_NAME "avx512"
+#include "bollie-retain-kernels.h"
+#undef KERNEL
+#undef KERNEL_NAME
+#pragma GCC pop_options
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__) && defined(__arm__) \
+    && !defined(__ARM_NEON)
+#define KERNELS_ARM
+
+#pragma GCC push_options
+#pragma GCC target("fpu=neon")
+#define KERNEL(name) neon_##name
+#define KERNEL_NAME "neon"
+#include "bollie-retain-kernels.h"
+#undef KERNEL
+#undef KERNEL_NAME
+#pragma GCC pop_options
+#endif
+
+
 /**
-* extension stuff for additional interfaces
+* Picks the best kernel variant the CPU supports. BOLLIERETAIN_ISA in the
+* environment selects another one, as long as the CPU supports it.
+* \return kernel table
 */
-static const void* extension_data(const char* uri) {
-    return NULL;
+static const Kernels* select_kernels(void) {
+    const Kernels* supported[4];
+    int n = 0;
+
+#ifdef KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl")
+        && __builtin_cpu_supports("avx512bw")
+        && __builtin_cpu_supports("avx512dq")) {
+        supported[n++] = &avx512_kernels;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        supported[n++] = &avx2_kernels;
+    }
+#endif
+#ifdef KERNELS_ARM
+    if (getauxval(AT_HWCAP) & HWCAP_NEON) {
+        supported[n++] = &neon_kernels;
+    }
+#endif
+    supported[n++] = &generic_kernels;
+
+    const char* isa = getenv(BOLLIERETAIN_ISA_ENV);
+    for (int i = 0 ; isa && i < n ; ++i) {
+        if (!strcmp(supported[i]->name, isa)
+            || (!strcmp(isa, "generic") && supported[i] == &generic_kernels)) {
+            return supported[i];
+        }
+    }
+    if (isa) {
+        fprintf(stderr, "bollieretain: %s=%s is not supported here, "
+            "using %s\n", BOLLIERETAIN_ISA_ENV, isa, supported[0]->name);
+    }
+    return supported[0];
 }
 
 
 /**
-* Descriptor linking our methods.
+* Finds the mid or side tape of a loop, its own one or its arena region.
+* \param self current plugin instance
+* \param take loop parameters
+* \param region arena region of the loop
+* \param side 0 for mid, 1 for side
+* \return start of the tape
 */
-static const LV2_Descriptor descriptor = {
-    URI,
+static float* loop_tape(BollieRetain* self, const Take* take, int region,
+    int side) {
+    if (take->tape) {
+        return take->tape + side * take->tape_len;
+    }
+    return (side ? self->arena_r : self->arena_l) + region * self->slot_len;
+}
+
+
+/**
+* Finds a band tape of a loop, its own one or its arena region.
+* \param self current plugin instance
+* \param take loop parameters
+* \param region arena region of the loop
+* \param band band tape index, low left, low right, high left, high right
+* \return start of the band tape
+*/
+static int16_t* loop_band(BollieRetain* self, const Take* take, int region,
+    int band) {
+    if (take->tape) {
+        return (int16_t*)(take->tape + 2 * take->tape_len)
+            + band * take->tape_len;
+    }
+    return self->band_arena + band * MAX_TAPE_LEN + region * self->slot_len;
+}
+
+
+/**
+* Points the tapes at a slot, its own tapes if it has them.
+* \param self current plugin instance
+* \param slot slot index
+*/
+static void use_slot(BollieRetain* self, int slot) {
+    const Take* take = &self->takes[slot];
+    int region = self->region[slot];
+
+    self->buffer_l = loop_tape(self, take, region, 0);
+    self->buffer_r = loop_tape(self, take, region, 1);
+    self->tape_len = take->tape ? take->tape_len : self->slot_len;
+    if (take->tape ? take->bands_captured : self->band_arena != NULL) {
+        self->band_low_l = loop_band(self, take, region, 0);
+        self->band_low_r = loop_band(self, take, region, 1);
+        self->band_high_l = loop_band(self, take, region, 2);
+        self->band_high_r = loop_band(self, take, region, 3);
+    }
+}
+
+
+/**
+* Hands own tapes over to the worker to free them, see release_tapes().
+* \param self current plugin instance
+* \param tape own tapes of a loop, NULL for none
+*/
+static void retire_tape(BollieRetain* self, float* tape) {
+    if (tape) {
+        self->retired[self->n_retired++] = tape;
+    }
+}
+
+
+/**
+* Asks the worker to free the retired tapes. Those the worker queue has
+* no room for stay for the next block.
+* \param self current plugin instance
+*/
+static void release_tapes(BollieRetain* self) {
+    int n = 0;
+
+    for (int i = 0 ; i < self->n_retired ; ++i) {
+        FreeJob job = { JOB_FREE, self->retired[i] };
+        if (self->schedule->schedule_work(self->schedule->handle,
+            sizeof(job), &job) != LV2_WORKER_SUCCESS) {
+            self->retired[n++] = self->retired[i];
+        }
+    }
+    self->n_retired = n;
+}
+
+
+/**
+* Frees all own tapes right away, outside of run().
+* \param self current plugin instance
+*/
+static void free_tapes(BollieRetain* self) {
+    for (int slot = 0 ; slot < HISTORY_LEN ; ++slot) {
+        free(self->takes[slot].tape);
+        self->takes[slot].tape = NULL;
+    }
+    if (self->bounce_pending) {
+        free(self->bounce_take.tape);
+    }
+    for (int i = 0 ; i < self->n_retired ; ++i) {
+        free(self->retired[i]);
+    }
+    self->n_retired = 0;
+}
+
+
+/**
+* Instantiates the plugin
+* Allocates memory for the BollieRetain object and returns a pointer as
+* LV2Handle.
+*/
+static LV2_Handle instantiate(const LV2_Descriptor * descriptor, double rate,
+    const char* bundle_path, const LV2_Feature* const* features) {
+    
+    BollieRetain *self = (BollieRetain*)calloc(1, sizeof(BollieRetain));
+    LV2_URID_Map* map = NULL;
+
+    for (int i = 0 ; features[i] ; ++i) {
+        if (!strcmp(features[i]->URI, LV2_WORKER__schedule)) {
+            self->schedule = (LV2_Worker_Schedule*)features[i]->data;
+        }
+        else if (!strcmp(features[i]->URI, LV2_URID__map)) {
+            map = (LV2_URID_Map*)features[i]->data;
+        }
+    }
+    if (!map) {
+        free(self);
+        return NULL;
+    }
+    self->midi_event = map->map(map->handle, LV2_MIDI__MidiEvent);
+    self->atom_object = map->map(map->handle, LV2_ATOM__Object);
+    self->atom_blank = map->map(map->handle, LV2_ATOM__Blank);
+    self->msg_undo = map->map(map->handle, BOLLIERETAIN__undo);
+    self->msg_redo = map->map(map->handle, BOLLIERETAIN__redo);
+    self->atom_float = map->map(map->handle, LV2_ATOM__Float);
+    self->time_position = map->map(map->handle, LV2_TIME__Position);
+    self->time_bpm = map->map(map->handle, LV2_TIME__beatsPerMinute);
+    use_scratch(self, &self->own_scratch);
+    self->kernels = select_kernels();
+
+    // Memorize sample rate for calculation
+    self->rate = rate;
+    self->n_fade_samples = ceil(0.05f * rate);
+    self->n_pulse_samples = ceil(WRAP_PULSE_MS * 0.001f * rate);
+    self->n_loop_samples = ceil(0.5f * rate);
+    if (self->n_loop_samples > MAX_TAPE_LEN - TAPE_PAD) {
+        self->n_loop_samples = MAX_TAPE_LEN - TAPE_PAD;
+    }
+    self->n_short_seam_samples = ceil(0.005f * rate);
+    self->n_zc_samples = ceil(0.005f * rate);
+    if (self->n_zc_samples > ZC_WINDOW_LEN / 2 - 1) {
+        self->n_zc_samples = ZC_WINDOW_LEN / 2 - 1;
+    }
+    self->n_wsola_samples = ceil(0.006f * rate);
+
+    // The tape arena holds as many loops as fit, each followed by silence.
+    // One region stays spare for bounces, if there are two at least.
+    self->slot_len = self->n_loop_samples + TAPE_PAD;
+    int n_regions = MAX_TAPE_LEN / self->slot_len;
+    self->n_slots = n_regions > 1 ? n_regions - 1 : 1;
+    if (self->n_slots > HISTORY_LEN) {
+        self->n_slots = HISTORY_LEN;
+    }
+    for (int slot = 0 ; slot < self->n_slots ; ++slot) {
+        self->region[slot] = slot;
+    }
+    self->spare_region = n_regions > self->n_slots ? self->n_slots : -1;
+    self->mix_decay = powf(MIX_SMOOTH, CONTROL_LEN);
+
+    // Periodic Hann window, overlapping by half it sums up to one
+    self->n_grain_samples = 2 * (int)ceil(0.02f * rate);
+    if (self->n_grain_samples > GRAIN_MAX_LEN) {
+        self->n_grain_samples = GRAIN_MAX_LEN;
+    }
+    for (int i = 0 ; i < self->n_grain_samples ; ++i) {
+        self->hann[i] = 0.5f - 0.5f * cos(2 * M_PI * i
+            / self->n_grain_samples);
+    }
+
+    // Sustain voices get different allpasses per voice and side, the
+    // sin^2 envelopes add up to SUSTAIN_VOICES * 3/8 in power
+    for (int v = 0 ; v < SUSTAIN_VOICES ; ++v) {
+        self->sustain_coeff[0][v] = 0.1f + 0.6f * v / SUSTAIN_VOICES;
+        self->sustain_coeff[1][v] = 0.7f - 0.6f * v / SUSTAIN_VOICES;
+    }
+    self->sustain_norm = sqrt(8.0 / (3.0 * SUSTAIN_VOICES));
+
+    // Fixed seeds, renders are meant to be reproducible
+    for (int l = 0 ; l < RNG_LANES ; ++l) {
+        self->rng_state[l] = 0x9e3779b9u * (l + 1);
+    }
+
+    // Twiddle factors for the seam search, e^(-2*pi*i*k/N)
+    for (int k = 0 ; k < MATCH_FFT_LEN / 2 ; ++k) {
+        double phi = 2 * M_PI * k / MATCH_FFT_LEN;
+        self->twiddle_re[k] = cos(phi);
+        self->twiddle_im[k] = -sin(phi);
+    }
+
+    // The band tapes come from the worker once needed, without one there's
+    // no way to allocate them later
+    if (!self->schedule) {
+        self->band_arena = calloc(BAND_TAPES * MAX_TAPE_LEN, sizeof(int16_t));
+    }
+
+    open_recording(self, rate);
+
+    return (LV2_Handle)self;
+}
+
+
+/**
+* Used by the host to connect the ports of this plugin.
+* \param instance current LV2_Handle (will be cast to BollieRetain*)
+* \param port LV2 port index, maches the enum above.
+* \param data Pointer to the actual port data.
+*/
+static void connect_port(LV2_Handle instance, uint32_t port, void *data) {
+    BollieRetain *self = (BollieRetain*)instance;
+
+    switch ((PortIdx)port) {
+        case BRT_BLEND:
+            self->ctl_blend = data;
+            break;
+        case BRT_TRIGGER:
+            self->ctl_trigger = data;
+            break;
+        case BRT_INPUT_L:
+            self->input_l = data;
+            break;
+        case BRT_INPUT_R:
+            self->input_r = data;
+            break;
+        case BRT_OUTPUT_L:
+            self->output_l = data;
+            break;
+        case BRT_OUTPUT_R:
+            self->output_r = data;
+            break;
+        case BRT_SEAM:
+            self->ctl_seam = data;
+            break;
+        case BRT_MODE:
+            self->ctl_mode = data;
+            break;
+        case BRT_STRETCH:
+            self->ctl_stretch = data;
+            break;
+        case BRT_SCATTER:
+            self->ctl_scatter = data;
+            break;
+        case BRT_CONTROL:
+            self->control = data;
+            break;
+        case BRT_ATTACK:
+            self->ctl_attack = data;
+            break;
+        case BRT_DECAY:
+            self->ctl_decay = data;
+            break;
+        case BRT_SUSTAIN:
+            self->ctl_sustain = data;
+            break;
+        case BRT_RELEASE:
+            self->ctl_release = data;
+            break;
+        case BRT_FILTER:
+            self->ctl_filter = data;
+            break;
+        case BRT_FILTER_FREQ:
+            self->ctl_filter_freq = data;
+            break;
+        case BRT_TILT:
+            self->ctl_tilt = data;
+            break;
+        case BRT_BANDS:
+            self->ctl_bands = data;
+            break;
+        case BRT_CROSSOVER:
+            self->ctl_crossover = data;
+            break;
+        case BRT_LOW:
+            self->ctl_low = data;
+            break;
+        case BRT_HIGH:
+            self->ctl_high = data;
+            break;
+        case BRT_WIDTH:
+            self->ctl_width = data;
+            break;
+        case BRT_NORMALIZE:
+            self->ctl_normalize = data;
+            break;
+        case BRT_QUALITY:
+            self->ctl_quality = data;
+            break;
+        case BRT_FREEWHEEL:
+            self->ctl_freewheel = data;
+            break;
+        case BRT_CPU_BUDGET:
+            self->ctl_cpu_budget = data;
+            break;
+        case BRT_HOLD:
+            self->ctl_hold = data;
+            break;
+        case BRT_HOLD_RELEASE:
+            self->ctl_hold_release = data;
+            break;
+        case BRT_PHASE:
+            self->cv_phase = data;
+            break;
+        case BRT_WRAP:
+            self->cv_wrap = data;
+            break;
+        case BRT_DUCK:
+            self->ctl_duck = data;
+            break;
+        case BRT_DUCK_THRESHOLD:
+            self->ctl_duck_threshold = data;
+            break;
+        case BRT_DUCK_ATTACK:
+            self->ctl_duck_attack = data;
+            break;
+        case BRT_DUCK_RELEASE:
+            self->ctl_duck_release = data;
+            break;
+        case BRT_KEY_L:
+            self->key_l = data;
+            break;
+        case BRT_KEY_R:
+            self->key_r = data;
+            break;
+        case BRT_WINDOW_START:
+            self->ctl_window_start = data;
+            break;
+        case BRT_WINDOW_END:
+            self->ctl_window_end = data;
+            break;
+        case BRT_SYNC:
+            self->ctl_sync = data;
+            break;
+        case BRT_WET_L:
+            self->wet_out_l = data;
+            break;
+        case BRT_WET_R:
+            self->wet_out_r = data;
+            break;
+        case BRT_DRY_L:
+            self->dry_out_l = data;
+            break;
+        case BRT_DRY_R:
+            self->dry_out_r = data;
+            break;
+        default:
+            break;
+    }
+
+    // The recorder follows control ports by index
+    if (port < BRT_N_PORTS && port != BRT_INPUT_L && port != BRT_INPUT_R
+        && port != BRT_OUTPUT_L && port != BRT_OUTPUT_R
+        && port != BRT_CONTROL && port != BRT_PHASE && port != BRT_WRAP
+        && port != BRT_KEY_L && port != BRT_KEY_R && port != BRT_WET_L
+        && port != BRT_WET_R && port != BRT_DRY_L && port != BRT_DRY_R) {
+        self->record_port[port] = data;
+    }
+}
+    
+
+/**
+* This has to reset all the internal states of the plugin
+* \param instance pointer to current plugin instance
+*/
+static void activate(LV2_Handle instance) {
+    BollieRetain* self = (BollieRetain*)instance;
+    free_tapes(self);
+    // Let's remove all that noise
+    for (int i = 0 ; i < MAX_TAPE_LEN ; ++i) {
+        self->arena_l[i] = 0;
+        self->arena_r[i] = 0;
+    }
+    use_slot(self, 0);
+    self->take = 0;
+    self->has_take = false;
+    self->n_undo = 0;
+    self->n_redo = 0;
+
+    // Reset state variables
+    self->pos_r = 0;
+    self->pos_w = 0;
+    self->dry_gain = 0;
+    self->wet_gain = 0;
+    self->blend = -1.0f;        // Out of range, gains follow at once
+    self->width = 1.0f;
+    self->held = false;
+    self->releasing = false;
+    self->hold_gain = 1.0f;
+    self->hold_step = 0;
+    self->clock_phase = -1.0f;
+    self->pulse_countdown = 0;
+    self->duck_env = 0;
+    self->duck_controls[0] = -1.0f;     // Out of range, follows at once
+    self->makeup_gain = 1.0f;
+    self->listening = false;
+    self->looping = false;      // Idle until the first capture
+    self->loop_start = self->n_fade_samples;
+    self->loop_end = self->n_loop_samples;
+    self->n_seam_samples = self->n_fade_samples;
+    self->seam_pending = false;
+    self->bounce_busy = false;
+    self->bounce_pending = false;
+    self->mode = MODE_LOOP;
+    self->tier = &tiers[QUALITY_STANDARD + 1];
+    self->governor_level = 0;
+    self->governor_load = 0;
+    self->governor_hold = 0;
+    self->n_grains = 0;
+    self->n_voices = 0;
+    for (int v = 0 ; v < SAMPLER_VOICES ; ++v) {
+        self->voice_stage[v] = STAGE_OFF;
+        self->voice_gain[v] = 0;
+        self->voice_rate[v] = 0;
+    }
+    self->filter_type = FILTER_OFF;
+    self->bands_captured = false;
+    self->bands_active = false;
+
+    if (self->record_file) {
+        uint8_t rec = BOLLIERETAIN_RECORD_ACTIVATE;
+        record(self, &rec, 1);
+        self->record_all = true;
+    }
+}
+
+
+/**
+* In-place iterative radix-2 FFT on split complex data.
+* \param self current plugin instance, holding the twiddle factors
+* \param re real parts, MATCH_FFT_LEN values
+* \param im imaginary parts, MATCH_FFT_LEN values
+* \param inverse true for the (unscaled) inverse transform
+*/
+static void fft(const BollieRetain* self, float* re, float* im, int inverse) {
+    const int n = MATCH_FFT_LEN;
+
+    // Bit reversal permutation
+    for (int i = 1, j = 0 ; i < n ; ++i) {
+        int bit = n >> 1;
+        for ( ; j & bit ; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            float t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+
+    // Butterflies
+    for (int len = 2 ; len <= n ; len <<= 1) {
+        int half = len >> 1;
+        int step = n / len;
+        for (int i = 0 ; i < n ; i += len) {
+            for (int k = 0 ; k < half ; ++k) {
+                float wr = self->twiddle_re[k * step];
+                float wi = inverse ? -self->twiddle_im[k * step]
+                    : self->twiddle_im[k * step];
+                int a = i + k;
+                int b = a + half;
+                float xr = re[b] * wr - im[b] * wi;
+                float xi = re[b] * wi + im[b] * wr;
+                re[b] = re[a] - xr;
+                im[b] = im[a] - xi;
+                re[a] += xr;
+                im[a] += xi;
+            }
+        }
+    }
+}
+
+
+/**
+* Searches the loop end whose surroundings match the loop start best.
+* The waveform around loop_start is cross-correlated against a window in
+* front of the nominal loop end. Both real signals are packed into one
+* complex FFT, the normalized correlation maximum defines the new end.
+* Runs on the worker thread, only reads the tape.
+* \param self current plugin instance
+* \param job job to fill with the result
+*/
+static void find_seam(BollieRetain* self, SeamJob* job) {
+    float* re = self->fft_re;
+    float* im = self->fft_im;
+    float* c_re = self->xcorr_re;
+    float* c_im = self->xcorr_im;
+    const int n = MATCH_FFT_LEN;
+    int loop_start = self->n_fade_samples;
+    const float* tape = self->arena_l + job->region * self->slot_len;
+
+    // Defaults, in case no usable match is found
+    job->loop_end = self->n_loop_samples;
+    job->n_seam_samples = self->n_fade_samples;
+
+    // Template is centered on loop_start, as far as the preroll allows
+    int h = loop_start < MATCH_LEN / 2 ? loop_start : MATCH_LEN / 2;
+    int t0 = loop_start - h;
+
+    // Candidate ends e in [e_max - w, e_max], compared at [e - h, e - h + L)
+    int e_max = self->n_loop_samples - MATCH_LEN + h;
+    int w = ceil(0.025 * self->rate);
+    if (w > n - MATCH_LEN) {
+        w = n - MATCH_LEN;
+    }
+    if (w > e_max - h - loop_start - self->n_fade_samples) {
+        w = e_max - h - loop_start - self->n_fade_samples;
+    }
+    if (w < 1) {
+        return;
+    }
+    int s0 = e_max - w - h;
+
+    // Pack template (real) and search window (imaginary), mid channel
+    for (int i = 0 ; i < n ; ++i) {
+        re[i] = 0;
+        im[i] = 0;
+    }
+    double e_t = 0;
+    for (int i = 0 ; i < MATCH_LEN ; ++i) {
+        re[i] = tape[t0 + i];
+        e_t += re[i] * re[i];
+    }
+    for (int i = 0 ; i < w + MATCH_LEN ; ++i) {
+        im[i] = tape[s0 + i];
+    }
+    if (e_t <= 0) {
+        return;
+    }
+
+    fft(self, re, im, false);
+
+    // Unpack both spectra and build conj(T) * S
+    for (int k = 0 ; k < n ; ++k) {
+        int m = (n - k) & (n - 1);
+        float t_re = 0.5f * (re[k] + re[m]);
+        float t_im = 0.5f * (im[k] - im[m]);
+        float s_re = 0.5f * (im[k] + im[m]);
+        float s_im = -0.5f * (re[k] - re[m]);
+        c_re[k] = t_re * s_re + t_im * s_im;
+        c_im[k] = t_re * s_im - t_im * s_re;
+    }
+
+    fft(self, c_re, c_im, true);
+
+    // Normalize with the sliding energy of the search window, the packed
+    // input is gone after the FFT so it's taken from the tape again
+    double e_s = 0;
+    for (int i = 0 ; i < MATCH_LEN ; ++i) {
+        float v = tape[s0 + i];
+        e_s += v * v;
+    }
+
+    float best = -1;
+    int best_k = w;
+    for (int k = 0 ; k <= w ; ++k) {
+        if (e_s > 0) {
+            float score = c_re[k] / n / sqrt(e_t * e_s);
+            if (score > best) {
+                best = score;
+                best_k = k;
+            }
+        }
+        if (k == w) {
+            break;
+        }
+        float v_out = tape[s0 + k];
+        float v_in = tape[s0 + k + MATCH_LEN];
+        e_s += v_in * v_in - v_out * v_out;
+    }
+
+    job->loop_end = e_max - w + best_k;
+    if (best >= MATCH_THRESHOLD) {
+        job->n_seam_samples = self->n_short_seam_samples;
+    }
+}
+
+
+/**
+* Finds the rising zero crossing of the channel pair closest to a target.
+* A crossing at i means the mid channel goes from negative at i - 1 to
+* non-negative at i. It's clean, if mid and side are close to zero there.
+* Scoring the whole window first keeps the scan branchless.
+* \param self current plugin instance
+* \param target preferred tape position
+* \param from first tape position to consider, at least 1
+* \param to tape position after the last one to consider
+* \return position of the crossing or -1 if there's no clean one
+*/
+static int find_zero_crossing(BollieRetain* self, int target, int from,
+    int to) {
+    const float* l = self->buffer_l + from;
+    const float* r = self->buffer_r + from;
+    float* score = self->zc_score;
+    int n = to - from;
+
+    for (int i = 0 ; i < n ; ++i) {
+        float level = fabsf(l[i]) + fabsf(r[i]);
+        score[i] = (l[i - 1] < 0 && l[i] >= 0) ? level : ZC_NONE;
+    }
+
+    int best = -1;
+    int best_dist = n;
+    for (int i = 0 ; i < n ; ++i) {
+        int dist = abs(from + i - target);
+        if (score[i] < ZC_THRESHOLD && dist < best_dist) {
+            best = from + i;
+            best_dist = dist;
+        }
+    }
+    return best;
+}
+
+
+/**
+* Snaps loop start and end to clean zero crossings around their nominal
+* positions. If both are found the seam needs no crossfade at all,
+* otherwise the nominal crossfade is kept.
+* \param self current plugin instance
+*/
+static void snap_to_zero_crossings(BollieRetain* self) {
+    int h = self->n_zc_samples;
+    int start = find_zero_crossing(self, self->n_fade_samples,
+        self->n_fade_samples - h, self->n_fade_samples + h + 1);
+    int end = find_zero_crossing(self, self->n_loop_samples,
+        self->n_loop_samples - 2 * h, self->n_loop_samples);
+
+    if (start >= 0 && end >= 0) {
+        self->loop_start = start;
+        self->loop_end = end;
+        self->n_seam_samples = 0;
+    }
+}
+
+
+/**
+* Hands a seam search for the capture just finished to the worker.
+* \param self current plugin instance
+*/
+static void schedule_seam(BollieRetain* self) {
+    if (!self->schedule) {
+        return;
+    }
+    SeamJob job = { JOB_SEAM, self->generation, self->region[self->take],
+        self->n_loop_samples, self->n_fade_samples };
+    self->schedule->schedule_work(self->schedule->handle, sizeof(job), &job);
+}
+
+
+/**
+* Copies a loop the way it plays, with the seam crossfade applied, and
+* repeats its start after it, so it can be read across the wrap.
+* Runs on the worker thread.
+* \param self current plugin instance
+* \param take loop parameters
+* \param tape tape to read, NULL to read the band tape
+* \param band compact band tape
+* \param out loop, a grain longer than the loop
+*/
+static void unroll_loop(const BollieRetain* self, const Take* take,
+    const float* tape, const int16_t* band, float* out) {
+    int length = take->loop_end - take->loop_start;
+    int seam_start = length - take->n_seam_samples;
+
+    for (int i = 0 ; i < length ; ++i) {
+        int k = take->loop_start + i;
+        out[i] = tape ? tape[k] : band[k] * (1.0f / COMPACT_SCALE);
+        if (i >= seam_start) {
+            float head = tape ? tape[k - length]
+                : band[k - length] * (1.0f / COMPACT_SCALE);
+            float c = (float)(i - seam_start) / take->n_seam_samples;
+            c = c * c * (3.0f - 2.0f * c);
+            out[i] += (head - out[i]) * c;
+        }
+    }
+    for (int i = 0 ; i < self->n_grain_samples ; ++i) {
+        out[length + i] = out[i % length];
+    }
+}
+
+
+/**
+* Allocates the bounce scratch on the first bounce, most instances never
+* follow a tempo. The source holds the tapes of the longest loop or that
+* loop unrolled with a grain after it, the sums hold the longest loop.
+* Runs on the worker thread.
+* \param self current plugin instance
+* \return false if out of memory
+*/
+static bool alloc_bounce(BollieRetain* self) {
+    if (self->bounce_src) {
+        return true;
+    }
+    int n_max = BOUNCE_MAX_LOOPS * self->n_loop_samples;
+    int n_src = self->n_fade_samples + n_max + TAPE_PAD
+        + self->n_grain_samples;
+    float* scratch = malloc((n_src + 2 * n_max) * sizeof(float));
+    if (!scratch) {
+        return false;
+    }
+    self->bounce_acc = scratch + n_src;
+    self->bounce_norm = self->bounce_acc + n_max;
+    self->bounce_src = scratch;
+    return true;
+}
+
+
+/**
+* Overlap-adds the grains of a bounce to one target tape, the loop repeats
+* over the whole tape, preroll included.
+* Runs on the worker thread.
+* \param self current plugin instance
+* \param job bounce job, grains placed by bounce()
+* \param tape tape to read, NULL to read the band tape
+* \param band compact band tape
+* \param out_tape tape to write, NULL to write the band tape
+* \param out_band compact band tape to write
+* \param out_len length of the target tape
+*/
+static void bounce_tape(BollieRetain* self, const BounceJob* job,
+    const float* tape, const int16_t* band, float* out_tape,
+    int16_t* out_band, int out_len) {
+    float* src = self->bounce_src;
+    float* acc = self->bounce_acc;
+    const float* norm = self->bounce_norm;
+    const float* hann = self->hann;
+    int n = job->length;
+    int n_grains = job->n_grains;
+    float spacing = (float)n / n_grains;
+
+    unroll_loop(self, &job->take, tape, band, src);
+    memset(acc, 0, n * sizeof(float));
+    for (int g = 0 ; g < n_grains ; ++g) {
+        const float* grain = src + self->bounce_pos[g];
+        int offset = (int)(g * spacing) - self->n_grain_samples / 2 + n;
+        for (int i = 0 ; i < self->n_grain_samples ; ++i) {
+            acc[(offset + i) % n] += grain[i] * hann[i];
+        }
+    }
+
+    float* out = out_tape ? out_tape : src;
+    for (int k = 0 ; k < out_len ; ++k) {
+        int j = (k - self->n_fade_samples + n) % n;
+        out[k] = acc[j] / norm[j];
+    }
+    if (!out_tape) {
+        self->kernels->compact(src, out_band, out_len);
+    }
+}
+
+
+/**
+* Stretches a loop to a new length without changing its pitch. Grains
+* read at unit speed are spread over the new length and aligned like in
+* wsola_align(), the bounced loop has no seam of its own. The first grain
+* is centered on the loop start, so the bounced loop starts where the
+* loop wraps to. Without a target region the worker allocates own tapes
+* for the bounced loop. Runs on the worker thread.
+* \param self current plugin instance
+* \param job job to fill with the bounced loop parameters
+*/
+static void bounce(BollieRetain* self, BounceJob* job) {
+    Take* take = &job->take;
+    const float* src = self->bounce_src;
+    float* norm = self->bounce_norm;
+    int* pos = self->bounce_pos;
+    int hop = self->n_grain_samples / 2;
+    int length = take->loop_end - take->loop_start;
+    int n = job->length;
+    Take out = *take;
+
+    out.tape = NULL;
+    out.tape_len = self->slot_len;
+    if (job->target < 0) {
+        out.tape_len = self->n_fade_samples + n + TAPE_PAD;
+        size_t n_bytes = 2 * out.tape_len * sizeof(float);
+        if (take->bands_captured) {
+            n_bytes += BAND_TAPES * out.tape_len * sizeof(int16_t);
+        }
+        out.tape = malloc(n_bytes);
+        if (!out.tape) {
+            return;
+        }
+    }
+
+    int n_grains = (n + hop / 2) / hop;
+    if (n_grains > BOUNCE_GRAINS) {
+        n_grains = BOUNCE_GRAINS;
+    }
+    job->n_grains = n_grains;
+    float spacing = (float)n / n_grains;
+    float ratio = (float)length / n;
+
+    // Each grain continues the previous one as closely as possible, the
+    // last one leads into the first one as well
+    unroll_loop(self, take, loop_tape(self, take, job->source, 0), NULL,
+        self->bounce_src);
+    pos[0] = length - hop;
+    for (int g = 1 ; g < n_grains ; ++g) {
+        int advance = (int)(g * spacing) - (int)((g - 1) * spacing);
+        int to_first = n - (int)(g * spacing);
+        int natural = (pos[g - 1] + advance) % length;
+        int nominal = (int)(g * spacing * ratio) - hop;
+        int best = nominal;
+        float best_score = -1e30f;
+        for (int cand = nominal - self->n_wsola_samples ;
+            cand <= nominal + self->n_wsola_samples ; ++cand) {
+            int start = (cand + length) % length;
+            float score = self->kernels->correlate(src + start,
+                src + natural, hop, 1);
+            if (g == n_grains - 1) {
+                score += self->kernels->correlate(
+                    src + (start + to_first) % length, src + pos[0], hop, 1);
+            }
+            if (score > best_score) {
+                best_score = score;
+                best = cand;
+            }
+        }
+        pos[g] = (best + length) % length;
+    }
+
+    // Window sum for the normalization, the spacing isn't exactly a hop
+    memset(norm, 0, n * sizeof(float));
+    for (int g = 0 ; g < n_grains ; ++g) {
+        int offset = (int)(g * spacing) - hop + n;
+        for (int i = 0 ; i < self->n_grain_samples ; ++i) {
+            norm[(offset + i) % n] += self->hann[i];
+        }
+    }
+
+    for (int side = 0 ; side < 2 ; ++side) {
+        bounce_tape(self, job, loop_tape(self, take, job->source, side),
+            NULL, loop_tape(self, &out, job->target, side), NULL,
+            out.tape_len);
+    }
+    for (int b = 0 ; take->bands_captured && b < BAND_TAPES ; ++b) {
+        bounce_tape(self, job, NULL, loop_band(self, take, job->source, b),
+            NULL, loop_band(self, &out, job->target, b), out.tape_len);
+    }
+
+    out.loop_start = self->n_fade_samples;
+    out.loop_end = self->n_fade_samples + n;
+    out.n_seam_samples = self->n_fade_samples;
+    out.bpm *= (float)length / n;
+    *take = out;
+}
+
+
+/**
+* Reads the playback mode port.
+* \param self current plugin instance
+*/
+static PlayMode get_mode(const BollieRetain* self) {
+    int mode = *self->ctl_mode;
+    if (mode < MODE_LOOP || mode > MODE_SAMPLER) {
+        return MODE_LOOP;
+    }
+    return (PlayMode)mode;
+}
+
+
+/**
+* Prepares the playback engine for a mode, continuing at the current
+* position of the previous one.
+* \param self current plugin instance
+* \param mode playback mode to start
+*/
+static void start_mode(BollieRetain* self, PlayMode mode) {
+    int pos = self->pos_r;
+    if (self->mode == MODE_STRETCH) {
+        pos = self->grain_pos;
+    }
+    else if (self->mode == MODE_SUSTAIN) {
+        pos = self->sustain_pos[0];
+    }
+    if (pos < self->loop_start) {
+        pos = self->loop_start;
+    }
+
+    if (mode == MODE_STRETCH) {
+        self->grain_pos = pos;
+        self->grain_countdown = 0;
+        self->grain_last_src = -1;
+        self->n_grains = 0;
+    }
+    else if (mode == MODE_SUSTAIN) {
+        int period = self->loop_end - self->loop_start;
+        for (int v = 0 ; v < SUSTAIN_VOICES ; ++v) {
+            int p = pos + v * period / SUSTAIN_VOICES;
+            self->sustain_pos[v] = p >= self->loop_end ? p - period : p;
+        }
+        memset(self->sustain_x1, 0, sizeof(self->sustain_x1));
+        memset(self->sustain_y1, 0, sizeof(self->sustain_y1));
+        self->sustain_gain = 0;
+    }
+    else if (mode == MODE_SAMPLER) {
+        for (int v = 0 ; v < SAMPLER_VOICES ; ++v) {
+            self->voice_stage[v] = STAGE_OFF;
+            self->voice_env[v] = 0;
+            self->voice_gain[v] = 0;
+            self->voice_pos[v] = self->loop_start;
+            self->voice_rate[v] = 0;
+        }
+        self->n_voices = 0;
+    }
+    else if (self->mode != MODE_LOOP) {
+        self->pos_r = pos;
+    }
+    self->mode = mode;
+}
+
+
+/**
+* Converts the captured loop to mid/side in place. All playback engines
+* are linear, so they work on mid and side just like on left and right,
+* and the width is a plain side gain in mix().
+* \param self current plugin instance
+*/
+static void to_mid_side(BollieRetain* self) {
+    float* restrict l = self->buffer_l;
+    float* restrict r = self->buffer_r;
+    int n = self->n_loop_samples;
+
+    for (int i = 0 ; i < n ; ++i) {
+        float m = (l[i] + r[i]) * 0.5f;
+        float s = (l[i] - r[i]) * 0.5f;
+        l[i] = m;
+        r[i] = s;
+    }
+
+    if (self->bands_captured) {
+        int16_t* restrict low_l = self->band_low_l;
+        int16_t* restrict low_r = self->band_low_r;
+        int16_t* restrict high_l = self->band_high_l;
+        int16_t* restrict high_r = self->band_high_r;
+        for (int i = 0 ; i < n ; ++i) {
+            int16_t m = (low_l[i] + low_r[i]) / 2;
+            int16_t s = (low_l[i] - low_r[i]) / 2;
+            low_l[i] = m;
+            low_r[i] = s;
+            m = (high_l[i] + high_r[i]) / 2;
+            s = (high_l[i] - high_r[i]) / 2;
+            high_l[i] = m;
+            high_r[i] = s;
+        }
+    }
+}
+
+
+/**
+* Keeps the parameters of the playing loop with its slot.
+* \param self current plugin instance
+*/
+static void store_take(BollieRetain* self) {
+    Take* take = &self->takes[self->take];
+
+    take->loop_start = self->loop_start;
+    take->loop_end = self->loop_end;
+    take->n_seam_samples = self->n_seam_samples;
+    take->makeup_gain = self->makeup_gain;
+    take->bands_captured = self->bands_captured;
+}
+
+
+/**
+* Selects the loop window within the captured loop. The full loop keeps
+* its seam, a trimmed window crossfades into the tape before its start,
+* as far as there is tape.
+* Only the bounds move, the tape stays as it is.
+* \param self current plugin instance
+*/
+static void apply_window(BollieRetain* self) {
+    const Take* take = &self->takes[self->take];
+    float start = fminf(fmaxf(*self->ctl_window_start * 0.01f, 0), 1.0f);
+    float end = fminf(fmaxf(*self->ctl_window_end * 0.01f, 0), 1.0f);
+    int length = take->loop_end - take->loop_start;
+    int min_length = 2 * self->n_fade_samples;
+
+    self->loop_start = take->loop_start;
+    self->loop_end = take->loop_end;
+    self->n_seam_samples = take->n_seam_samples;
+    if ((start <= 0 && end >= 1.0f) || length <= min_length) {
+        return;
+    }
+
+    int window_start = take->loop_start + (int)(start * length);
+    int window_end = take->loop_start + (int)(end * length);
+    if (window_end - window_start < min_length) {
+        window_end = window_start + min_length;
+        if (window_end > take->loop_end) {
+            window_end = take->loop_end;
+            window_start = window_end - min_length;
+        }
+    }
+    // The seam can't reach in front of the tape, a zero crossing snap
+    // leaves less than a fade there
+    self->loop_start = window_start;
+    self->loop_end = window_end;
+    self->n_seam_samples = window_start < self->n_fade_samples
+        ? window_start : self->n_fade_samples;
+}
+
+
+/**
+* Finds the spot of the bounced loop playing what a position of the loop
+* before played. The grain reading it tells, the grain sources are left
+* in bounce_pos by the worker.
+* \param self current plugin instance
+* \param pos tape position in the loop before
+* \return tape position in the bounced loop
+*/
+static double bounce_position(const BollieRetain* self, double pos) {
+    const Take* from = &self->takes[self->take];
+    const Take* to = &self->bounce_take;
+    int length = from->loop_end - from->loop_start;
+    int n = to->loop_end - to->loop_start;
+    int hop = self->n_grain_samples / 2;
+    float spacing = (float)n / self->bounce_n_grains;
+    double rel = fmod(pos - from->loop_start + length, length);
+
+    // Distance to the closest grain center in the loop before
+    int best = 0;
+    double best_dist = length;
+    for (int g = 0 ; g < self->bounce_n_grains ; ++g) {
+        double dist = rel - (self->bounce_pos[g] + hop) % length;
+        if (dist >= 0.5 * length) {
+            dist -= length;
+        }
+        else if (dist < -0.5 * length) {
+            dist += length;
+        }
+        if (fabs(dist) < fabs(best_dist)) {
+            best = g;
+            best_dist = dist;
+        }
+    }
+
+    double q = fmod((int)(best * spacing) + best_dist + n, n);
+    return to->loop_start + q;
+}
+
+
+/**
+* Drops a bounced loop waiting for the wrap, the loop it belongs to is
+* gone.
+* \param self current plugin instance
+*/
+static void drop_bounce(BollieRetain* self) {
+    if (self->bounce_pending) {
+        retire_tape(self, self->bounce_take.tape);
+        self->bounce_pending = false;
+    }
+}
+
+
+/**
+* Swaps a bounced loop in, its region or own tapes take the place of the
+* loop's ones. Jobs for the loop before are stale from now on.
+* \param self current plugin instance
+*/
+static void swap_bounce(BollieRetain* self) {
+    int region = self->region[self->take];
+
+    // Playing positions move to the same spot of the bounced loop
+    self->grain_pos = bounce_position(self, self->grain_pos);
+    for (int g = 0 ; g < self->n_grains ; ++g) {
+        float read = self->grain_phase[g] * self->grain_rate[g];
+        self->grain_src[g] = fmax(bounce_position(self,
+            self->grain_src[g] + read) - read, 0);
+    }
+    if (self->grain_last_src >= 0) {
+        self->grain_last_src = bounce_position(self, self->grain_last_src);
+    }
+    for (int v = 0 ; v < SUSTAIN_VOICES ; ++v) {
+        self->sustain_pos[v] = bounce_position(self, self->sustain_pos[v]);
+    }
+    for (int v = 0 ; v < SAMPLER_VOICES ; ++v) {
+        self->voice_pos[v] = bounce_position(self, self->voice_pos[v]);
+    }
+
+    // A loop bounced to own tapes keeps its region, the tapes it played
+    // before are freed either way
+    retire_tape(self, self->takes[self->take].tape);
+    if (!self->bounce_take.tape) {
+        self->region[self->take] = self->spare_region;
+        self->spare_region = region;
+    }
+    self->takes[self->take] = self->bounce_take;
+    self->bounce_pending = false;
+    self->seam_pending = false;
+    ++self->generation;
+    use_slot(self, self->take);
+}
+
+
+/**
+* Applies a bounced loop, a seam search result and the loop window,
+* called when the loop wraps.
+* \param self current plugin instance
+*/
+static void update_bounds(BollieRetain* self) {
+    if (self->bounce_pending) {
+        swap_bounce(self);
+    }
+    if (self->seam_pending) {
+        self->takes[self->take].loop_end = self->pending_loop_end;
+        self->takes[self->take].n_seam_samples
+            = self->pending_n_seam_samples;
+        self->seam_pending = false;
+    }
+    apply_window(self);
+}
+
+
+/**
+* Ends a capture and starts looping the fresh tape.
+* \param self current plugin instance
+*/
+static void finish_capture(BollieRetain* self) {
+    SeamMode seam = (SeamMode)*self->ctl_seam;
+
+    // Makeup gain towards the target level, without pushing the peak
+    // over full scale
+    float rms = sqrt(self->capture_energy / (2.0 * self->n_loop_samples));
+    self->makeup_gain = 1.0f;
+    if (rms > 1e-5f) {
+        self->makeup_gain = fminf(NORMALIZE_RMS / rms, NORMALIZE_MAX);
+        self->makeup_gain = fminf(self->makeup_gain,
+            1.0f / self->capture_peak);
+    }
+
+    to_mid_side(self);
+
+    self->listening = false;
+    self->looping = true;
+    self->pos_r = 0;
+
+    // The fresh loop becomes the latest one in the history
+    int slot = (self->take + 1) % self->n_slots;
+    if (self->has_take && slot != self->take) {
+        ++self->n_undo;
+    }
+    self->take = slot;
+    self->has_take = true;
+
+    // Start over with the nominal seam and refine it
+    self->loop_start = self->n_fade_samples;
+    self->loop_end = self->n_loop_samples;
+    self->n_seam_samples = self->n_fade_samples;
+    self->seam_pending = false;
+    drop_bounce(self);
+    ++self->generation;
+    if (seam == SEAM_MATCH) {
+        schedule_seam(self);
+    }
+    else if (seam == SEAM_ZERO_CROSSING) {
+        snap_to_zero_crossings(self);
+    }
+    store_take(self);
+    self->takes[slot].bpm = self->host_bpm;
+    apply_window(self);
+
+    self->mode = MODE_LOOP;
+    start_mode(self, get_mode(self));
+}
+
+
+/**
+* Calculates biquad coefficients, following the RBJ audio EQ cookbook.
+* \param bq biquad to set
+* \param type FILTER_LOWPASS, FILTER_HIGHPASS or FILTER_TILT for a low
+*   shelf, negate the gain for the high shelf
+* \param high true for a high shelf, only used with FILTER_TILT
+* \param freq corner frequency in Hz
+* \param q quality, only used with low and high pass
+* \param gain shelf gain in dB
+* \param rate sample rate
+*/
+static void set_biquad(Biquad* bq, FilterType type, bool high, float freq,
+    float q, float gain, double rate) {
+    double w0 = 2 * M_PI * freq / rate;
+    double cos_w0 = cos(w0);
+    double sin_w0 = sin(w0);
+    double b0, b1, b2, a0, a1, a2;
+
+    if (type == FILTER_TILT) {
+        // Shelf slope 1
+        double a = pow(10.0, gain / 40.0);
+        double beta = 2 * sqrt(a) * sin_w0 / 2 * M_SQRT2;
+        double sign = high ? -1 : 1;
+        b0 = a * ((a + 1) - sign * (a - 1) * cos_w0 + beta);
+        b1 = sign * 2 * a * ((a - 1) - sign * (a + 1) * cos_w0);
+        b2 = a * ((a + 1) - sign * (a - 1) * cos_w0 - beta);
+        a0 = (a + 1) + sign * (a - 1) * cos_w0 + beta;
+        a1 = -sign * 2 * ((a - 1) + sign * (a + 1) * cos_w0);
+        a2 = (a + 1) + sign * (a - 1) * cos_w0 - beta;
+    }
+    else {
+        double alpha = sin_w0 / (2 * q);
+        double c = type == FILTER_LOWPASS ? 1 - cos_w0 : 1 + cos_w0;
+        b0 = c / 2;
+        b1 = type == FILTER_LOWPASS ? c : -c;
+        b2 = c / 2;
+        a0 = 1 + alpha;
+        a1 = -2 * cos_w0;
+        a2 = 1 - alpha;
+    }
+
+    bq->b0 = b0 / a0;
+    bq->b1 = b1 / a0;
+    bq->b2 = b2 / a0;
+    bq->a1 = a1 / a0;
+    bq->a2 = a2 / a0;
+}
+
+
+/**
+* Splits a captured chunk into the band tapes with a Linkwitz-Riley
+* crossover, two squared Butterworth sections per band.
+* \param self current plugin instance
+* \param in_l left input
+* \param in_r right input
+* \param n number of samples
+*/
+static void capture_bands(BollieRetain* self, const float* in_l,
+    const float* in_r, uint32_t n) {
+    const Kernels* kernels = self->kernels;
+    float* tmp_l = self->scratch_l;
+    float* tmp_r = self->scratch_r;
+    int pos_w = self->pos_w;
+
+    kernels->biquad_stage(&self->xover_low, &self->xover_z1[0],
+        &self->xover_z2[0], in_l, in_r, tmp_l, tmp_r, n);
+    kernels->biquad_stage(&self->xover_low, &self->xover_z1[1],
+        &self->xover_z2[1], tmp_l, tmp_r, tmp_l, tmp_r, n);
+    kernels->compact(tmp_l, self->band_low_l + pos_w, n);
+    kernels->compact(tmp_r, self->band_low_r + pos_w, n);
+
+    kernels->biquad_stage(&self->xover_high, &self->xover_z1[2],
+        &self->xover_z2[2], in_l, in_r, tmp_l, tmp_r, n);
+    kernels->biquad_stage(&self->xover_high, &self->xover_z1[3],
+        &self->xover_z2[3], tmp_l, tmp_r, tmp_l, tmp_r, n);
+    kernels->compact(tmp_l, self->band_high_l + pos_w, n);
+    kernels->compact(tmp_r, self->band_high_r + pos_w, n);
+}
+
+
+/**
+* Points the tapes at the slot after the latest loop for a capture. What
+* that slot held leaves the history.
+* \param self current plugin instance
+*/
+static void start_take(BollieRetain* self) {
+    int slot = (self->take + 1) % self->n_slots;
+
+    // The capture goes to the arena region of the slot
+    retire_tape(self, self->takes[slot].tape);
+    self->takes[slot].tape = NULL;
+    use_slot(self, slot);
+    self->n_redo = 0;
+    if (slot == self->take) {
+        self->has_take = false;
+    }
+    else if (self->n_undo > self->n_slots - 2) {
+        self->n_undo = self->n_slots - 2;
+    }
+}
+
+
+/**
+* Writes input to the tape while listening.
+* \param self current plugin instance
+* \param in_l left input
+* \param in_r right input
+* \param n number of samples available
+* \return number of samples consumed, less than n if the capture ended
+*/
+static uint32_t capture(BollieRetain* self, const float* in_l,
+    const float* in_r, uint32_t n) {
+    uint32_t len = self->n_loop_samples - self->pos_w;
+    if (len > n) {
+        len = n;
+    }
+
+    // Fresh capture, the crossover is set up from the current controls
+    if (self->pos_w == 0) {
+        start_take(self);
+        self->capture_energy = 0;
+        self->capture_peak = 0;
+        self->bands_captured = *self->ctl_bands > 0 && self->band_arena;
+        if (self->bands_captured) {
+            float freq = fminf(fmaxf(*self->ctl_crossover, 20.0f),
+                0.45f * self->rate);
+            set_biquad(&self->xover_low, FILTER_LOWPASS, false, freq,
+                M_SQRT1_2, 0, self->rate);
+            set_biquad(&self->xover_high, FILTER_HIGHPASS, false, freq,
+                M_SQRT1_2, 0, self->rate);
+            for (int s = 0 ; s < 4 ; ++s) {
+                self->xover_z1[s] = (stereo_t){ 0, 0 };
+                self->xover_z2[s] = (stereo_t){ 0, 0 };
+            }
+        }
+    }
+    if (self->bands_captured) {
+        capture_bands(self, in_l, in_r, len);
+    }
+    self->kernels->measure(in_l, in_r, len, &self->capture_energy,
+        &self->capture_peak);
+
+    memcpy(self->buffer_l + self->pos_w, in_l, len * sizeof(float));
+    memcpy(self->buffer_r + self->pos_w, in_r, len * sizeof(float));
+    memset(self->wet_l, 0, len * sizeof(float));
+    memset(self->wet_r, 0, len * sizeof(float));
+    self->pos_w += len;
+
+    if (self->pos_w >= self->n_loop_samples) {
+        finish_capture(self);
+    }
+    return len;
+}
+
+
+/**
+* Reads a span of the loop. With band tapes the bands are mixed by their
+* levels, otherwise it's a plain copy of the tape. Debug builds check the
+* span stays on the tapes.
+* \param self current plugin instance
+* \param pos tape position
+* \param out_l left output
+* \param out_r right output
+* \param n number of samples
+*/
+static void read_tape(const BollieRetain* self, int pos,
+    float* restrict out_l, float* restrict out_r, uint32_t n) {
+    assert(pos >= 0 && pos + (int)n <= self->tape_len);
+
+    if (!self->bands_active) {
+        memcpy(out_l, self->buffer_l + pos, n * sizeof(float));
+        memcpy(out_r, self->buffer_r + pos, n * sizeof(float));
+        return;
+    }
+
+    self->kernels->decode_bands(self->band_low_l + pos,
+        self->band_low_r + pos, self->band_high_l + pos,
+        self->band_high_r + pos, self->band_gain_low / COMPACT_SCALE,
+        self->band_gain_high / COMPACT_SCALE, out_l, out_r, n);
+}
+
+
+/**
+* Renders the verbatim loop. The loop is split into regions (preroll,
+* plain, seam, fade out), each rendered as one contiguous span.
+* \param self current plugin instance
+* \param n number of samples requested
+* \return number of samples rendered, less than n if a capture starts
+*/
+static uint32_t render_loop(BollieRetain* self, uint32_t n) {
+    int pos_r = self->pos_r;
+    int n_fade_samples = self->n_fade_samples;
+    int loop_start = self->loop_start;
+    int loop_end = self->loop_end;
+    int n_seam_samples = self->n_seam_samples;
+    int listening = self->listening;
+    int smooth_seam = self->tier->smooth_seam;
+
+    // A trimmed window only plays the fade in front of it as preroll
+    int preroll = loop_start > n_fade_samples ? loop_start - n_fade_samples
+        : 0;
+    if (pos_r < preroll) {
+        pos_r = preroll;
+    }
+
+    uint32_t i = 0;
+    while (i < n) {
+        float* wet_l = self->wet_l + i;
+        float* wet_r = self->wet_r + i;
+        uint32_t len = n - i;
+
+        if (pos_r < loop_start) {
+            // First pass through the preroll, fade in from silence
+            if (len > (uint32_t)(loop_start - pos_r)) {
+                len = loop_start - pos_r;
+            }
+            read_tape(self, pos_r, wet_l, wet_r, len);
+            self->kernels->ramp(wet_l, wet_r, len,
+                (float)(pos_r - preroll) / (loop_start - preroll),
+                1.0f / (loop_start - preroll));
+        }
+        else if (listening && pos_r >= loop_end - n_fade_samples) {
+            // Capture pending, fade out towards it
+            if (len > (uint32_t)(loop_end - pos_r)) {
+                len = loop_end - pos_r;
+            }
+            read_tape(self, pos_r, wet_l, wet_r, len);
+            self->kernels->ramp(wet_l, wet_r, len,
+                (float)(loop_end - pos_r) / n_fade_samples,
+                -1.0f / n_fade_samples);
+        }
+        else if (!listening && pos_r >= loop_end - n_seam_samples) {
+            // Crossfade the tail into the material before loop_start
+            float* head_l = self->scratch_l;
+            float* head_r = self->scratch_r;
+            float coeff = (float)(pos_r - loop_end + n_seam_samples)
+                / n_seam_samples;
+            float step = 1.0f / n_seam_samples;
+            if (len > (uint32_t)(loop_end - pos_r)) {
+                len = loop_end - pos_r;
+            }
+            read_tape(self, pos_r, wet_l, wet_r, len);
+            read_tape(self, pos_r - loop_end + loop_start, head_l, head_r,
+                len);
+            for (uint32_t j = 0 ; j < len ; ++j) {
+                float c = coeff + step * j;
+                if (smooth_seam) {
+                    c = c * c * (3.0f - 2.0f * c);
+                }
+                wet_l[j] += (head_l[j] - wet_l[j]) * c;
+                wet_r[j] += (head_r[j] - wet_r[j]) * c;
+            }
+        }
+        else {
+            // Simply copy up to the next region
+            int boundary = loop_end - (listening ? n_fade_samples
+                : n_seam_samples);
+            if (len > (uint32_t)(boundary - pos_r)) {
+                len = boundary - pos_r;
+            }
+            read_tape(self, pos_r, wet_l, wet_r, len);
+        }
+
+        pos_r += len;
+        i += len;
+        // reset to loop start at the end of the loop
+        if (pos_r >= loop_end) {
+            if (listening) {
+                self->looping = false;
+                self->pos_r = 0;
+                self->pos_w = 0;
+                return i;
+            }
+            update_bounds(self);
+            loop_start = self->loop_start;
+            loop_end = self->loop_end;
+            n_seam_samples = self->n_seam_samples;
+            pos_r = loop_start;
+        }
+    }
+    self->pos_r = pos_r;
+    return n;
+}
+
+
+/**
+* Picks the start of the next grain (WSOLA). Around the nominal position
+* the tape segment most similar to the natural continuation of the
+* previous grain is searched, so overlapping grains add up in phase.
+* \param self current plugin instance
+* \param nominal tape position the stretched timeline asks for
+* \param natural tape position continuing the previous grain
+* \return tape position of the next grain
+*/
+static int wsola_align(const BollieRetain* self, int nominal, int natural) {
+    const float* buffer_l = self->buffer_l;
+    const Tier* tier = self->tier;
+    int hop = self->n_grain_samples / 2;
+    int from = nominal - self->n_wsola_samples;
+    int to = nominal + self->n_wsola_samples;
+    if (from < 0) {
+        from = 0;
+    }
+    if (to > self->loop_end - self->n_grain_samples) {
+        to = self->loop_end - self->n_grain_samples;
+    }
+
+    int best = nominal;
+    float best_score = -1e30f;
+    for (int cand = from ; cand <= to ; cand += tier->wsola_step) {
+        float score = self->kernels->correlate(buffer_l + cand,
+            buffer_l + natural, hop, tier->wsola_stride);
+        if (score > best_score) {
+            best_score = score;
+            best = cand;
+        }
+    }
+    return best;
+}
+
+
+/**
+* Refills the batch of random numbers. The xorshift lanes are independent,
+* so the inner loop advances all of them at once.
+* \param self current plugin instance
+*/
+static void fill_random(BollieRetain* self) {
+    uint32_t* state = self->rng_state;
+
+    for (int b = 0 ; b < RANDOM_BATCH ; b += RNG_LANES) {
+        for (int l = 0 ; l < RNG_LANES ; ++l) {
+            uint32_t x = state[l];
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            state[l] = x;
+            self->random[b + l] = (int32_t)x * (1.0f / 2147483648.0f);
+        }
+    }
+    self->n_random = RANDOM_BATCH;
+}
+
+
+/**
+* Takes a random number from the batch.
+* \param self current plugin instance
+* \return random number in [-1, 1)
+*/
+static float next_random(BollieRetain* self) {
+    if (!self->n_random) {
+        fill_random(self);
+    }
+    return self->random[--self->n_random];
+}
+
+
+/**
+* Starts a new grain at the current stretched position. With scatter the
+* position, pitch and panorama of the grain are randomized, otherwise it
+* is WSOLA aligned to the previous one. The tape is mid/side, so the pan
+* gains are turned into a mid/side matrix.
+* \param self current plugin instance
+*/
+static void spawn_grain(BollieRetain* self) {
+    int n_grain_samples = self->n_grain_samples;
+    int loop_start = self->loop_start;
+    int loop_end = self->loop_end;
+    int period = loop_end - loop_start;
+    float scatter = self->scatter;
+
+    if (self->n_grains >= GRAIN_POOL_LEN) {
+        return;
+    }
+
+    int src = self->grain_pos;
+    float rate = 1.0f;
+    float pan_a = 1.0f;
+    float pan_b = 0;
+    if (scatter > 0) {
+        src += next_random(self) * scatter * period / 2;
+        if (src < loop_start) {
+            src += period;
+        }
+        else if (src >= loop_end) {
+            src -= period;
+        }
+        rate = exp2f(next_random(self) * scatter * SCATTER_PITCH / 12);
+        float theta = (1 + next_random(self) * scatter) * (float)M_PI / 4;
+        float gain_l = (float)M_SQRT2 * cosf(theta);
+        float gain_r = (float)M_SQRT2 * sinf(theta);
+        pan_a = (gain_l + gain_r) * 0.5f;
+        pan_b = (gain_l - gain_r) * 0.5f;
+    }
+
+    // Grains running into the loop end are read from the same loop
+    // position one period earlier, where the tape continues seamlessly
+    int span = ceil(n_grain_samples * rate) + 1;
+    if (src + span + self->n_wsola_samples > loop_end) {
+        src -= period;
+    }
+    if (src < 0) {
+        src = 0;
+    }
+    if (scatter == 0 && self->grain_last_src >= 0
+        && self->tier->wsola_step) {
+        src = wsola_align(self, src,
+            self->grain_last_src + n_grain_samples / 2);
+    }
+
+    self->grain_src[self->n_grains] = src;
+    self->grain_phase[self->n_grains] = 0;
+    self->grain_rate[self->n_grains] = rate;
+    self->grain_pan_a[self->n_grains] = pan_a;
+    self->grain_pan_b[self->n_grains] = pan_b;
+    self->grain_last_src = src;
+    ++self->n_grains;
+}
+
+
+/**
+* Adds the active grains to the wet signal and retires finished ones.
+* Grains at their original pitch are read straight from the tape, others
+* are read with linear interpolation.
+* \param self current plugin instance
+* \param wet_l left wet signal to add to
+* \param wet_r right wet signal to add to
+* \param n number of samples
+*/
+static void sum_grains(BollieRetain* self, float* restrict wet_l,
+    float* restrict wet_r, uint32_t n) {
+    int n_grain_samples = self->n_grain_samples;
+    int cubic = self->tier->cubic;
+
+    for (int g = 0 ; g < self->n_grains ; ) {
+        int phase = self->grain_phase[g];
+        int len = n_grain_samples - phase;
+        if (len > (int)n) {
+            len = n;
+        }
+
+        float rate = self->grain_rate[g];
+        float pan_a = self->grain_pan_a[g];
+        float pan_b = self->grain_pan_b[g];
+        const float* restrict window = self->hann + phase;
+        if (rate == 1.0f) {
+            int src = self->grain_src[g] + phase;
+            self->kernels->add_grain(wet_l, wet_r, self->buffer_l + src,
+                self->buffer_r + src, window, pan_a, pan_b, len);
+        }
+        else {
+            self->kernels->add_pitched_grain(wet_l, wet_r, self->buffer_l,
+                self->buffer_r, self->grain_src[g], phase, rate, window,
+                pan_a, pan_b, len, cubic);
+        }
+
+        phase += len;
+        if (phase >= n_grain_samples) {
+            // Retire, the last grain takes its slot
+            int last = --self->n_grains;
+            self->grain_src[g] = self->grain_src[last];
+            self->grain_phase[g] = self->grain_phase[last];
+            self->grain_rate[g] = self->grain_rate[last];
+            self->grain_pan_a[g] = self->grain_pan_a[last];
+            self->grain_pan_b[g] = self->grain_pan_b[last];
+        }
+        else {
+            self->grain_phase[g] = phase;
+            ++g;
+        }
+    }
+}
+
+
+/**
+* Renders the time stretched loop by overlapping Hann windowed grains.
+* \param self current plugin instance
+* \param n number of samples requested
+* \return number of samples rendered, less than n if a capture starts
+*/
+static uint32_t render_grains(BollieRetain* self, uint32_t n) {
+    float stretch = *self->ctl_stretch;
+    int hop = self->n_grain_samples / 2;
+
+    if (stretch < 1.0f) {
+        stretch = 1.0f;
+    }
+    else if (stretch > MAX_STRETCH) {
+        stretch = MAX_STRETCH;
+    }
+    self->scatter = *self->ctl_scatter * 0.01f;
+    if (self->scatter < 0) {
+        self->scatter = 0;
+    }
+    else if (self->scatter > 1.0f) {
+        self->scatter = 1.0f;
+    }
+
+    memset(self->wet_l, 0, n * sizeof(float));
+    memset(self->wet_r, 0, n * sizeof(float));
+
+    uint32_t i = 0;
+    while (i < n) {
+        if (self->grain_countdown == 0) {
+            if (!self->listening) {
+                spawn_grain(self);
+            }
+            else if (self->n_grains == 0) {
+                // Capture pending and the last grain faded out
+                self->looping = false;
+                self->pos_w = 0;
+                return i;
+            }
+            self->grain_countdown = hop;
+        }
+
+        uint32_t len = n - i;
+        if (len > (uint32_t)self->grain_countdown) {
+            len = self->grain_countdown;
+        }
+        sum_grains(self, self->wet_l + i, self->wet_r + i, len);
+        self->grain_countdown -= len;
+        i += len;
+
+        // Advance the stretched timeline
+        self->grain_pos += len / stretch;
+        if (self->grain_pos >= self->loop_end) {
+            double overshoot = self->grain_pos - self->loop_end;
+            update_bounds(self);
+            self->grain_pos = self->loop_start + overshoot;
+        }
+    }
+    return n;
+}
+
+
+/**
+* Renders the sustained loop. Every voice plays the whole loop, staggered
+* by a fraction of the period, under a sin^2 envelope that is zero where
+* the voice wraps. So the seam is never heard and the staggered envelopes
+* crossfade the voices into each other. A first order allpass per voice
+* and side decorrelates the copies. Voices are kept as arrays, so the
+* inner loop works on all of them at once.
+* \param self current plugin instance
+* \param n number of samples requested
+* \return number of samples rendered, less than n if a capture starts
+*/
+static uint32_t render_sustain(BollieRetain* self, uint32_t n) {
+    int* pos = self->sustain_pos;
+
+    // The seam doesn't matter here, but the loop length does
+    update_bounds(self);
+    int period = self->loop_end - self->loop_start;
+    for (int v = 0 ; v < SUSTAIN_VOICES ; ++v) {
+        while (pos[v] >= self->loop_end) {
+            pos[v] -= period;
+        }
+        while (pos[v] < self->loop_start) {
+            pos[v] += period;
+        }
+    }
+
+    uint32_t done = self->kernels->sustain_segment(self, self->wet_l,
+        self->wet_r, n);
+    if (done < n) {
+        // Faded out for a pending capture
+        self->looping = false;
+        self->pos_w = 0;
+    }
+    return done;
+}
+
+
+/**
+* Starts the next note of a voice from the loop start, or turns the voice
+* off if the note was let go already.
+* \param self current plugin instance
+* \param voice voice index
+*/
+static void start_voice(BollieRetain* self, int voice) {
+    if (self->voice_next_velocity[voice] <= 0) {
+        self->voice_stage[voice] = STAGE_OFF;
+        --self->n_voices;
+        return;
+    }
+    self->voice_stage[voice] = STAGE_ATTACK;
+    self->voice_velocity[voice] = self->voice_next_velocity[voice];
+    self->voice_pos[voice] = self->loop_start;
+    self->voice_rate[voice] = self->voice_next_rate[voice];
+}
+
+
+/**
+* Starts a sampler voice, stealing the oldest one if none is free.
+* \param self current plugin instance
+* \param note MIDI note number
+* \param velocity MIDI velocity
+*/
+static void note_on(BollieRetain* self, int note, int velocity) {
+    int voice = 0;
+    for (int v = 0 ; v < SAMPLER_VOICES ; ++v) {
+        if (self->voice_stage[v] == STAGE_OFF) {
+            voice = v;
+            break;
+        }
+        if (self->voice_age[v] < self->voice_age[voice]) {
+            voice = v;
+        }
+    }
+
+    self->voice_note[voice] = note;
+    self->voice_age[voice] = ++self->note_counter;
+    self->voice_next_velocity[voice] = velocity / 127.0f;
+    self->voice_next_rate[voice] = exp2f((note - SAMPLER_ROOT) / 12.0f);
+    if (self->voice_stage[voice] == STAGE_OFF) {
+        ++self->n_voices;
+        self->voice_env[voice] = 0;
+        start_voice(self, voice);
+    }
+    else {
+        // A stolen voice fades out where it plays, so the jump to the
+        // loop start doesn't click
+        self->voice_stage[voice] = STAGE_STEAL;
+    }
+}
+
+
+/**
+* Releases sampler voices.
+* \param self current plugin instance
+* \param note MIDI note number to release, -1 for all
+*/
+static void note_off(BollieRetain* self, int note) {
+    for (int v = 0 ; v < SAMPLER_VOICES ; ++v) {
+        if (self->voice_stage[v] == STAGE_OFF
+            || self->voice_stage[v] == STAGE_RELEASE
+            || (note >= 0 && self->voice_note[v] != note)) {
+            continue;
+        }
+        // A stolen voice still fading out never starts its note
+        if (self->voice_stage[v] == STAGE_STEAL) {
+            self->voice_next_velocity[v] = 0;
+        }
+        else {
+            self->voice_stage[v] = STAGE_RELEASE;
+        }
+    }
+}
+
+
+/**
+* Starts playing a loop of the history from its preroll. Seam searches
+* still running belong to another loop and are ignored.
+* \param self current plugin instance
+* \param slot slot of the loop
+*/
+static void select_take(BollieRetain* self, int slot) {
+    const Take* take = &self->takes[slot];
+
+    use_slot(self, slot);
+    self->take = slot;
+    apply_window(self);
+    self->makeup_gain = take->makeup_gain;
+    self->bands_captured = take->bands_captured;
+    self->seam_pending = false;
+    drop_bounce(self);
+    ++self->generation;
+
+    self->listening = false;
+    self->releasing = false;
+    self->looping = true;
+    self->pos_r = 0;
+    self->mode = MODE_LOOP;
+    start_mode(self, get_mode(self));
+}
+
+
+/**
+* Steps back in the loop history. A pending or running capture is called
+* off first, back to the loop before it.
+* \param self current plugin instance
+*/
+static void undo(BollieRetain* self) {
+    if (self->listening && self->looping) {
+        self->listening = false;
+    }
+    else if (!self->looping) {
+        self->listening = false;
+        self->pos_w = 0;
+        if (self->has_take) {
+            select_take(self, self->take);
+        }
+    }
+    else if (self->n_undo > 0) {
+        --self->n_undo;
+        ++self->n_redo;
+        select_take(self, (self->take + self->n_slots - 1) % self->n_slots);
+    }
+}
+
+
+/**
+* Steps forward in the loop history again.
+* \param self current plugin instance
+*/
+static void redo(BollieRetain* self) {
+    if (self->listening || !self->looping || self->n_redo == 0) {
+        return;
+    }
+    --self->n_redo;
+    ++self->n_undo;
+    select_take(self, (self->take + 1) % self->n_slots);
+}
+
+
+/**
+* Bounces the loop to the host tempo, if it changed since the loop was
+* captured or bounced last. The worker writes the bounced loop to the
+* spare region, or to own tapes of the loop if it outgrows a slot or
+* there is no spare region. It replaces the loop at the next wrap.
+* \param self current plugin instance
+*/
+static void sync_tempo(BollieRetain* self) {
+    Take* take = &self->takes[self->take];
+
+    if (*self->ctl_sync <= 0 || !self->schedule || !self->has_take
+        || self->listening || self->host_bpm <= 0 || self->bounce_busy
+        || self->bounce_pending || self->seam_pending || self->n_retired) {
+        return;
+    }
+    if (take->bpm <= 0) {
+        // Captured without a tempo, it belongs to the first one known
+        take->bpm = self->host_bpm;
+        return;
+    }
+
+    int length = take->loop_end - take->loop_start;
+    int target = lrintf(length * take->bpm / self->host_bpm);
+    if (target < 2 * self->n_fade_samples) {
+        target = 2 * self->n_fade_samples;
+    }
+    if (target > BOUNCE_MAX_LOOPS * self->n_loop_samples) {
+        target = BOUNCE_MAX_LOOPS * self->n_loop_samples;
+    }
+    if (abs(target - length) <= 1) {
+        return;
+    }
+
+    // The preroll and the pad come on top of the loop
+    int region = self->spare_region;
+    if (self->n_fade_samples + target + TAPE_PAD > self->slot_len) {
+        region = -1;
+    }
+    BounceJob job = { JOB_BOUNCE, self->generation, self->region[self->take],
+        region, target, 0, *take };
+    self->bounce_busy = self->schedule->schedule_work(
+        self->schedule->handle, sizeof(job), &job) == LV2_WORKER_SUCCESS;
+}
+
+
+/**
+* Handles an incoming event from the control port.
+* \param self current plugin instance
+* \param ev the event
+*/
+static void handle_event(BollieRetain* self, const LV2_Atom_Event* ev) {
+    if (ev->body.type == self->atom_object
+        || ev->body.type == self->atom_blank) {
+        const LV2_Atom_Object* obj = (const LV2_Atom_Object*)&ev->body;
+        if (obj->body.otype == self->msg_undo) {
+            undo(self);
+        }
+        else if (obj->body.otype == self->msg_redo) {
+            redo(self);
+        }
+        else if (position_bpm(self, obj) > 0) {
+            self->host_bpm = position_bpm(self, obj);
+        }
+        return;
+    }
+
+    if (ev->body.type != self->midi_event || self->mode != MODE_SAMPLER
+        || !self->looping || self->listening) {
+        return;
+    }
+
+    const uint8_t* msg = (const uint8_t*)(ev + 1);
+    switch (lv2_midi_message_type(msg)) {
+        case LV2_MIDI_MSG_NOTE_ON:
+            if (msg[2]) {
+                note_on(self, msg[1], msg[2]);
+                break;
+            }
+            // fall through - zero velocity is a note off
+        case LV2_MIDI_MSG_NOTE_OFF:
+            note_off(self, msg[1]);
+            break;
+        case LV2_MIDI_MSG_CONTROLLER:
+            if (msg[1] == LV2_MIDI_CTL_ALL_NOTES_OFF
+                || msg[1] == LV2_MIDI_CTL_ALL_SOUNDS_OFF) {
+                note_off(self, -1);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+
+/**
+* Advances the voice envelopes by one segment. Stage changes happen at
+* segment boundaries, within a segment the gain is a linear ramp.
+* \param self current plugin instance
+* \param len segment length
+*/
+static void update_envelopes(BollieRetain* self, uint32_t len) {
+    float ms = self->rate * 0.001f;
+    float attack_step = 1.0f / (ms * fmaxf(*self->ctl_attack, 1.0f));
+    float decay_step = 1.0f / (ms * fmaxf(*self->ctl_decay, 1.0f));
+    float release_step = 1.0f / (ms * fmaxf(*self->ctl_release, 1.0f));
+    float steal_step = 1.0f / (ms * STEAL_MS);
+    float sustain = fminf(fmaxf(*self->ctl_sustain * 0.01f, 0), 1.0f);
+
+    // A pending capture cuts all voices short
+    if (self->listening) {
+        note_off(self, -1);
+        release_step = fmaxf(release_step, 1.0f / self->n_fade_samples);
+    }
+
+    for (int v = 0 ; v < SAMPLER_VOICES ; ++v) {
+        float env = self->voice_env[v];
+
+        // Faded out over the last segment, the stolen voice moves on
+        if (self->voice_stage[v] == STAGE_STEAL && env <= 0) {
+            self->voice_gain[v] = 0;
+            start_voice(self, v);
+        }
+        switch (self->voice_stage[v]) {
+            case STAGE_ATTACK:
+                env += attack_step * len;
+                if (env >= 1.0f) {
+                    env = 1.0f;
+                    self->voice_stage[v] = STAGE_DECAY;
+                }
+                break;
+            case STAGE_DECAY:
+                env -= decay_step * (1.0f - sustain) * len;
+                if (env <= sustain) {
+                    env = sustain;
+                    self->voice_stage[v] = STAGE_SUSTAIN;
+                }
+                break;
+            case STAGE_SUSTAIN:
+                env = sustain;
+                break;
+            case STAGE_RELEASE:
+                env -= release_step * len;
+                if (env <= 0) {
+                    env = 0;
+                    self->voice_stage[v] = STAGE_OFF;
+                    --self->n_voices;
+                }
+                break;
+            case STAGE_STEAL:
+                env = fmaxf(env - steal_step * len, 0);
+                break;
+            case STAGE_OFF:
+                // Silent from now on, the kernel skips it
+                env = 0;
+                self->voice_gain[v] = 0;
+                self->voice_rate[v] = 0;
+                break;
+        }
+        self->voice_env[v] = env;
+
+        float gain = env * self->voice_velocity[v];
+        self->voice_gain_step[v] = (gain - self->voice_gain[v]) / len;
+    }
+}
+
+
+/**
+* Renders the sampler voices. Each sounding voice is rendered over the
+* whole segment at once, silent ones are skipped. The loop seam is
+* crossfaded per voice.
+* The envelopes advance once per call, by one sub-block at most.
+* \param self current plugin instance
+* \param n number of samples requested, up to CONTROL_LEN
+* \return number of samples rendered, less than n if a capture starts
+*/
+static uint32_t render_sampler(BollieRetain* self, uint32_t n) {
+    if (!self->n_voices) {
+        memset(self->wet_l, 0, n * sizeof(float));
+        memset(self->wet_r, 0, n * sizeof(float));
+        if (self->listening) {
+            self->looping = false;
+            self->pos_w = 0;
+            return 0;
+        }
+        return n;
+    }
+
+    // Keep the voices inside a window that just moved
+    update_bounds(self);
+    float period = self->loop_end - self->loop_start;
+    for (int v = 0 ; v < SAMPLER_VOICES ; ++v) {
+        while (self->voice_pos[v] >= self->loop_end) {
+            self->voice_pos[v] -= period;
+        }
+        while (self->voice_pos[v] < self->loop_start) {
+            self->voice_pos[v] += period;
+        }
+    }
+    update_envelopes(self, n);
+    self->kernels->sampler_segment(self, self->wet_l, self->wet_r, n);
+    return n;
+}
+
+
+/**
+* Recalculates the wet filter targets, if its parameters changed.
+* A new filter type takes effect at once with cleared states, other
+* changes are smoothed by filter_wet().
+* \param self current plugin instance
+*/
+static void update_filter(BollieRetain* self) {
+    int type = *self->ctl_filter;
+    float freq = fminf(fmaxf(*self->ctl_filter_freq, 20.0f),
+        0.45f * self->rate);
+    float tilt = *self->ctl_tilt;
+
+    if (type < FILTER_OFF || type > FILTER_TILT) {
+        type = FILTER_OFF;
+    }
+    if (type == (int)self->filter_type && freq == self->filter_freq
+        && tilt == self->filter_tilt) {
+        return;
+    }
+
+    if (type == FILTER_TILT) {
+        // Low shelf down and high shelf up by half the tilt each
+        set_biquad(&self->filter_target[0], FILTER_TILT, false, freq, 0,
+            -tilt / 2, self->rate);
+        set_biquad(&self->filter_target[1], FILTER_TILT, true, freq, 0,
+            tilt / 2, self->rate);
+    }
+    else if (type != FILTER_OFF) {
+        // 4th order Butterworth
+        set_biquad(&self->filter_target[0], (FilterType)type, false, freq,
+            0.5412f, 0, self->rate);
+        set_biquad(&self->filter_target[1], (FilterType)type, false, freq,
+            1.3066f, 0, self->rate);
+    }
+
+    if (type != (int)self->filter_type) {
+        for (int s = 0 ; s < FILTER_STAGES ; ++s) {
+            self->filter_coeff[s] = self->filter_target[s];
+            self->filter_z1[s] = (stereo_t){ 0, 0 };
+            self->filter_z2[s] = (stereo_t){ 0, 0 };
+        }
+    }
+    self->filter_type = type;
+    self->filter_freq = freq;
+    self->filter_tilt = tilt;
+}
+
+
+/**
+* Runs the wet signal through the filter cascade, left and right as one
+* vector. The coefficients are smoothed by update_controls().
+* \param self current plugin instance
+* \param n number of samples
+*/
+static void filter_wet(BollieRetain* self, uint32_t n) {
+    if (self->filter_type == FILTER_OFF) {
+        return;
+    }
+
+    for (int s = 0 ; s < FILTER_STAGES ; ++s) {
+        self->kernels->biquad_stage(&self->filter_coeff[s],
+            &self->filter_z1[s], &self->filter_z2[s], self->wet_l,
+            self->wet_r, self->wet_l, self->wet_r, n);
+    }
+}
+
+
+/**
+* Moves a gain towards its target by the one-pole smoothing of n samples.
+* \param self current plugin instance
+* \param gain current gain
+* \param target gain to smooth towards
+* \param n number of samples
+* \return gain after n samples
+*/
+static float smooth_gain(const BollieRetain* self, float gain, float target,
+    uint32_t n) {
+    float decay = n == CONTROL_LEN ? self->mix_decay : powf(MIX_SMOOTH, n);
+    return target + (gain - target) * decay;
+}
+
+
+/**
+* Finds the input span to mix from. An in-place host may hand out the
+* input buffer as any output, so with more than the mixed output in use
+* the input is kept aside before the first output overwrites it.
+* \param self current plugin instance
+* \param offset position within the host block
+* \param n number of samples
+* \param in_l left input span
+* \param in_r right input span
+*/
+static void input_span(BollieRetain* self, uint32_t offset, uint32_t n,
+    const float** in_l, const float** in_r) {
+    *in_l = self->input_l + offset;
+    *in_r = self->input_r + offset;
+    if (self->wet_out_l || self->wet_out_r || self->dry_out_l
+        || self->dry_out_r) {
+        memcpy(self->held_l, *in_l, n * sizeof(float));
+        memcpy(self->held_r, *in_r, n * sizeof(float));
+        *in_l = self->held_l;
+        *in_r = self->held_r;
+    }
+}
+
+
+/**
+* Finds where a pair of outputs is written. Each port is optional on its
+* own, an unconnected side of a pair goes to the scratch signals.
+* \param self current plugin instance
+* \param port_l left port buffer or NULL
+* \param port_r right port buffer or NULL
+* \param offset position within the host block
+* \param out_l left span to write
+* \param out_r right span to write
+* \return false if neither side is connected
+*/
+static bool output_pair(BollieRetain* self, float* port_l, float* port_r,
+    uint32_t offset, float** out_l, float** out_r) {
+    *out_l = port_l ? port_l + offset : self->scratch_l;
+    *out_r = port_r ? port_r + offset : self->scratch_r;
+    return port_l || port_r;
+}
+
+
+/**
+* Mixes dry and wet signal into the outputs. The wet signal is mid/side,
+* decoded with the wet gain for mid and the wet gain times the width for
+* side. The gains follow their targets with a one-pole smoothing evaluated
+* at the end of the span, within it they ramp linearly. The hold envelope
+* is folded into the wet gain the same way.
+* The split variant writes both parts to outputs of their own as well,
+* they add up to the mix. Only connected outputs are written, so a wet bus
+* alone skips the mix and never reads the input.
+* \param self current plugin instance
+* \param offset position within the host block
+* \param n number of samples
+*/
+static void mix(BollieRetain* self, uint32_t offset, uint32_t n) {
+    const float* input_l;
+    const float* input_r;
+    const float* wet_l = self->wet_l;
+    const float* wet_r = self->wet_r;
+    float dry_gain = self->dry_gain;
+    float width = self->width;
+
+    // Paraemter smoothing for wet and dry gain
+    float dry_end = smooth_gain(self, dry_gain, self->target_dry_gain, n);
+    float wet_end = smooth_gain(self, self->wet_gain, self->target_wet_gain,
+        n);
+    float hold_end = fminf(fmaxf(self->hold_gain + self->hold_step * n, 0),
+        1.0f);
+    float wet_gain = self->wet_gain * self->hold_gain;
+    float dry_step = (dry_end - dry_gain) / n;
+    float wet_step = (wet_end * hold_end - wet_gain) / n;
+    float* out_l;
+    float* out_r;
+
+    input_span(self, offset, n, &input_l, &input_r);
+    if (output_pair(self, self->output_l, self->output_r, offset, &out_l,
+        &out_r)) {
+        self->kernels->mix_out(input_l, input_r, wet_l, wet_r, out_l, out_r,
+            n, dry_gain, dry_step, wet_gain, wet_step, width);
+    }
+    if (output_pair(self, self->wet_out_l, self->wet_out_r, offset, &out_l,
+        &out_r)) {
+        self->kernels->mix_wet(wet_l, wet_r, out_l, out_r, n, wet_gain,
+            wet_step, width);
+    }
+    if (output_pair(self, self->dry_out_l, self->dry_out_r, offset, &out_l,
+        &out_r)) {
+        self->kernels->pass_dry(input_l, input_r, out_l, out_r, n, dry_gain,
+            dry_step);
+    }
+    self->dry_gain = dry_end;
+    self->wet_gain = wet_end;
+    self->hold_gain = hold_end;
+}
+
+
+/**
+* Idle fast path, only the dry signal passes.
+* \param self current plugin instance
+* \param offset position within the host block
+* \param n number of samples
+*/
+static void mix_dry(BollieRetain* self, uint32_t offset, uint32_t n) {
+    const float* input_l;
+    const float* input_r;
+    float dry_gain = self->dry_gain;
+    float dry_end = smooth_gain(self, dry_gain, self->target_dry_gain, n);
+    float dry_step = (dry_end - dry_gain) / n;
+    float* out_l;
+    float* out_r;
+
+    input_span(self, offset, n, &input_l, &input_r);
+    if (output_pair(self, self->output_l, self->output_r, offset, &out_l,
+        &out_r)) {
+        self->kernels->pass_dry(input_l, input_r, out_l, out_r, n, dry_gain,
+            dry_step);
+    }
+    if (output_pair(self, self->wet_out_l, self->wet_out_r, offset, &out_l,
+        &out_r)) {
+        memset(out_l, 0, n * sizeof(float));
+        memset(out_r, 0, n * sizeof(float));
+    }
+    if (output_pair(self, self->dry_out_l, self->dry_out_r, offset, &out_l,
+        &out_r)) {
+        self->kernels->pass_dry(input_l, input_r, out_l, out_r, n, dry_gain,
+            dry_step);
+    }
+    self->dry_gain = dry_end;
+    self->wet_gain = smooth_gain(self, self->wet_gain, self->target_wet_gain,
+        n);
+}
+
+
+/**
+* Loop clock of the playing stage, the share of the loop period played.
+* The preroll counts up from below zero, the sampler has no clock.
+* \param self current plugin instance
+* \param phase loop phase at the next sample
+* \return phase increment per sample, 0 if there is no clock
+*/
+static float loop_clock(BollieRetain* self, float* phase) {
+    float period = self->loop_end - self->loop_start;
+
+    if (!self->looping) {
+        return 0;
+    }
+    if (self->mode == MODE_STRETCH) {
+        float stretch = fminf(fmaxf(*self->ctl_stretch, 1.0f), MAX_STRETCH);
+        *phase = (self->grain_pos - self->loop_start) / period;
+        return 1.0f / (stretch * period);
+    }
+    if (self->mode == MODE_SUSTAIN) {
+        *phase = (self->sustain_pos[0] - self->loop_start) / period;
+        return 1.0f / period;
+    }
+    if (self->mode == MODE_LOOP) {
+        *phase = (self->pos_r - self->loop_start) / period;
+        return 1.0f / period;
+    }
+    return 0;
+}
+
+
+/**
+* Writes the loop phase and wrap trigger outputs of a span. The wrap
+* trigger fires when the loop passes its start, so also after the preroll.
+* \param self current plugin instance
+* \param offset position within the host block
+* \param n number of samples
+* \param phase loop phase of the first sample
+* \param step phase increment per sample, 0 if there is no clock
+*/
+static void write_clock(BollieRetain* self, uint32_t offset, uint32_t n,
+    float phase, float step) {
+    uint32_t wrap = n;
+    float next = 0;
+
+    if (step <= 0) {
+        phase = 0;
+        self->clock_phase = -1.0f;
+    }
+    else {
+        // The loop starts at the first sample, or somewhere in the span
+        float last = self->clock_phase;
+        if (phase >= 1.0f) {
+            phase -= 1.0f;
+        }
+        if (phase >= 0 && (last < 0 || phase < last)) {
+            wrap = 0;
+            next = phase;
+        }
+        else {
+            float bound = phase < 0 ? 0 : 1.0f;
+            float until = (bound - phase) / step;
+            if (until < n) {
+                wrap = ceilf(until);
+            }
+            // Rounding may let the ramp reach the bound a sample earlier
+            while (wrap > 0 && phase + step * (wrap - 1) >= bound) {
+                --wrap;
+            }
+            if (wrap < n) {
+                next = phase + step * wrap - bound;
+            }
+        }
+        self->clock_phase = wrap < n ? next + step * (n - 1 - wrap)
+            : phase + step * (n - 1);
+    }
+
+    // The ramp restarts at the wrap, both parts vectorize
+    if (self->cv_phase) {
+        self->kernels->phase_ramp(self->cv_phase + offset, phase, step,
+            wrap);
+        if (wrap < n) {
+            self->kernels->phase_ramp(self->cv_phase + offset + wrap, next,
+                step, n - wrap);
+        }
+    }
+
+    float* out = self->cv_wrap ? self->cv_wrap + offset : NULL;
+    uint32_t i = 0;
+    while (i < n) {
+        uint32_t len = n - i;
+        if (i == wrap) {
+            self->pulse_countdown = self->n_pulse_samples;
+        }
+        else if (i < wrap && len > wrap - i) {
+            len = wrap - i;
+        }
+        uint32_t high = (uint32_t)self->pulse_countdown < len
+            ? (uint32_t)self->pulse_countdown : len;
+        if (out) {
+            for (uint32_t j = 0 ; j < len ; ++j) {
+                out[i + j] = j < high ? 1.0f : 0;
+            }
+        }
+        self->pulse_countdown -= high;
+        i += len;
+    }
+}
+
+
+/**
+* Stops playback after a hold faded out. Nothing is rendered until the
+* next capture, the wet filter starts from silence then.
+* \param self current plugin instance
+*/
+static void go_idle(BollieRetain* self) {
+    self->releasing = false;
+    self->listening = false;
+    self->looping = false;
+    self->pos_r = 0;
+    self->pos_w = 0;
+    self->n_grains = 0;
+    for (int v = 0 ; v < SAMPLER_VOICES ; ++v) {
+        self->voice_stage[v] = STAGE_OFF;
+        self->voice_gain[v] = 0;
+        self->voice_rate[v] = 0;
+    }
+    self->n_voices = 0;
+    for (int s = 0 ; s < FILTER_STAGES ; ++s) {
+        self->filter_z1[s] = (stereo_t){ 0, 0 };
+        self->filter_z2[s] = (stereo_t){ 0, 0 };
+    }
+}
+
+
+/**
+* Envelope coefficient of a time constant over a span.
+* \param self current plugin instance
+* \param ms time constant in ms
+* \param n number of samples
+* \return coefficient
+*/
+static float span_decay(const BollieRetain* self, float ms, uint32_t n) {
+    return expf(-(float)n / (fmaxf(ms, 0.1f) * 0.001f * self->rate));
+}
+
+
+/**
+* Ducks the wet signal while the key is loud. Each dB the key power rises
+* above the threshold takes a dB off the wet gain, up to the depth. The
+* key is measured per sub-block and the envelope follows it with attack
+* and release coefficients for the whole span, the resulting gain scales
+* the wet gain target, so the mix smoothing ramps it for free.
+* \param self current plugin instance
+* \param offset position within the host block
+* \param n number of samples
+*/
+static void duck(BollieRetain* self, uint32_t offset, uint32_t n) {
+    float depth = *self->ctl_duck;
+
+    if (depth <= 0 || (!self->looping && !self->listening)) {
+        self->duck_env = 0;
+        return;
+    }
+
+    // Coefficients, only when the controls moved
+    float controls[4] = {
+        depth, *self->ctl_duck_threshold, *self->ctl_duck_attack,
+        *self->ctl_duck_release
+    };
+    if (memcmp(controls, self->duck_controls, sizeof(controls))) {
+        memcpy(self->duck_controls, controls, sizeof(controls));
+        self->duck_floor = powf(10.0f, -0.05f * depth);
+        self->duck_threshold = powf(10.0f, 0.1f * controls[1]);
+        self->duck_attack = span_decay(self, controls[2], CONTROL_LEN);
+        self->duck_release = span_decay(self, controls[3], CONTROL_LEN);
+    }
+
+    const float* key_l = self->key_l ? self->key_l : self->input_l;
+    const float* key_r = self->key_l ? self->key_r : self->input_r;
+    if (!key_r) {
+        key_r = key_l;
+    }
+    double energy = 0;
+    float peak = 0;
+    self->kernels->measure(key_l + offset, key_r + offset, n, &energy,
+        &peak);
+    float power = energy / (2 * n);
+
+    int rising = power > self->duck_env;
+    float decay = rising ? self->duck_attack : self->duck_release;
+    if (n != CONTROL_LEN) {
+        decay = span_decay(self, self->duck_controls[rising ? 2 : 3], n);
+    }
+    self->duck_env = power + (self->duck_env - power) * decay;
+
+    // A dB of power over the threshold is a dB of amplitude off
+    if (self->duck_env > self->duck_threshold) {
+        self->target_wet_gain *= fmaxf(
+            sqrtf(self->duck_threshold / self->duck_env), self->duck_floor);
+    }
+}
+
+
+/**
+* Control-rate work, once per sub-block: follows the controls and the
+* play mode and moves the smoothed parameters on. Its cost doesn't depend
+* on the host block size.
+* \param self current plugin instance
+*/
+static void update_controls(BollieRetain* self) {
+    float ctl_blend = *self->ctl_blend;
+
+    // The band tapes are allocated the first time they're asked for
+    if (*self->ctl_bands > 0 && !self->band_arena_requested
+        && self->schedule) {
+        BandJob job = { JOB_BANDS, NULL };
+        self->band_arena_requested = self->schedule->schedule_work(
+            self->schedule->handle, sizeof(job), &job) == LV2_WORKER_SUCCESS;
+    }
+
+    // Now listen
+    if (*(self->ctl_trigger) > 0 && !self->listening) {
+        self->listening = true;
+        self->releasing = false;
+    }
+
+    // Momentary hold, pressing captures like the trigger, letting go fades
+    // the loop out and goes idle once silent
+    int held = *self->ctl_hold > 0;
+    if (held && !self->held) {
+        self->listening = true;
+        self->releasing = false;
+    }
+    else if (!held && self->held && (self->looping || self->listening)) {
+        self->releasing = true;
+    }
+    self->held = held;
+    if (self->releasing && self->hold_gain <= 0) {
+        go_idle(self);
+    }
+    self->hold_step = self->releasing
+        ? -1.0f / (self->rate * 0.001f * fmaxf(*self->ctl_hold_release, 1.0f))
+        : 1.0f / self->n_fade_samples;
+    
+    // Gain calculation, only when the blend moved
+    if (ctl_blend != self->blend) {
+        float target_dry_gain = 1;
+        float target_wet_gain = 0;
+        if (ctl_blend > 0 && ctl_blend < 50) {
+            target_wet_gain = powf(10.0f, (ctl_blend-50) * 0.04f);
+        }
+        else if (ctl_blend < 100 && ctl_blend > 50) {
+            target_wet_gain = 1;
+            target_dry_gain = powf(10.0f, (ctl_blend-50) * -0.04f);
+        }
+        else if (ctl_blend == 50) {
+            target_wet_gain = 1;
+        }
+        else if (ctl_blend == 100) {
+            target_wet_gain = 1;
+            target_dry_gain = 0;
+        }
+        self->blend = ctl_blend;
+        self->blend_dry_gain = target_dry_gain;
+        self->blend_wet_gain = target_wet_gain;
+    }
+
+    // The makeup gain rides on the wet gain smoothing
+    self->target_dry_gain = self->blend_dry_gain;
+    self->target_wet_gain = self->blend_wet_gain;
+    if (*self->ctl_normalize > 0) {
+        self->target_wet_gain *= self->makeup_gain;
+    }
+
+    // Freewheeling hosts render offline, where the best kernels are free
+    // and there is no deadline to govern
+    int tier = QUALITY_HIGH + 1;
+    if (*self->ctl_freewheel <= 0) {
+        tier = fminf(fmaxf(*self->ctl_quality, QUALITY_ECONOMY),
+            QUALITY_HIGH) + 1 - self->governor_level;
+    }
+    self->tier = &tiers[tier > 0 ? tier : 0];
+
+    // Filter coefficients move towards their targets
+    update_filter(self);
+    if (self->filter_type != FILTER_OFF) {
+        for (int s = 0 ; s < FILTER_STAGES ; ++s) {
+            Biquad* c = &self->filter_coeff[s];
+            const Biquad* t = &self->filter_target[s];
+            c->b0 += (t->b0 - c->b0) * FILTER_SMOOTH;
+            c->b1 += (t->b1 - c->b1) * FILTER_SMOOTH;
+            c->b2 += (t->b2 - c->b2) * FILTER_SMOOTH;
+            c->a1 += (t->a1 - c->a1) * FILTER_SMOOTH;
+            c->a2 += (t->a2 - c->a2) * FILTER_SMOOTH;
+        }
+    }
+
+    // Follow mode changes of the running loop
+    PlayMode mode = get_mode(self);
+    if (self->looping && mode != self->mode) {
+        start_mode(self, mode);
+    }
+
+    // Band levels and width follow the controls
+    self->bands_active = self->bands_captured && *self->ctl_bands > 0
+        && self->mode == MODE_LOOP;
+    self->band_gain_low += (fminf(fmaxf(*self->ctl_low * 0.01f, 0), 1.0f)
+        - self->band_gain_low) * FILTER_SMOOTH;
+    self->band_gain_high += (fminf(fmaxf(*self->ctl_high * 0.01f, 0),
+        1.0f) - self->band_gain_high) * FILTER_SMOOTH;
+    self->width += (fminf(fmaxf(*self->ctl_width * 0.01f, 0), 2.0f)
+        - self->width) * FILTER_SMOOTH;
+}
+
+
+/**
+* Renders the wet signal of the current stage into the scratch buffers.
+* \param self current plugin instance
+* \param offset position within the host block
+* \param n number of samples, up to CONTROL_LEN
+* \return number of samples rendered, less than n on a state change
+*/
+static uint32_t render(BollieRetain* self, uint32_t offset, uint32_t n) {
+    if (self->listening && !self->looping) {
+        return capture(self, self->input_l + offset, self->input_r + offset,
+            n);
+    }
+    if (self->looping && self->mode == MODE_STRETCH) {
+        return render_grains(self, n);
+    }
+    if (self->looping && self->mode == MODE_SUSTAIN) {
+        return render_sustain(self, n);
+    }
+    if (self->looping && self->mode == MODE_SAMPLER) {
+        return render_sampler(self, n);
+    }
+    if (self->looping) {
+        return render_loop(self, n);
+    }
+    memset(self->wet_l, 0, n * sizeof(float));
+    memset(self->wet_r, 0, n * sizeof(float));
+    return n;
+}
+
+
+/**
+* CPU governor, steps the quality down while run() overruns its share of
+* the block period and back up once there is headroom again. Stepping down
+* follows quickly, stepping up waits a second.
+* \param self current plugin instance
+* \param n_samples block length
+* \param start time run() started at
+*/
+static void govern(BollieRetain* self, uint32_t n_samples,
+    const struct timespec* start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    float elapsed = (end.tv_sec - start->tv_sec)
+        + (end.tv_nsec - start->tv_nsec) * 1e-9f;
+    float budget = n_samples / self->rate
+        * fminf(*self->ctl_cpu_budget, 100.0f) * 0.01f;
+    self->governor_load += (elapsed / budget - self->governor_load)
+        * GOVERNOR_SMOOTH;
+
+    self->governor_hold -= n_samples;
+    if (self->governor_hold > 0) {
+        return;
+    }
+    if (self->governor_load > GOVERNOR_DEGRADE
+        && self->governor_level < GOVERNOR_LEVELS) {
+        ++self->governor_level;
+        self->governor_hold = self->n_fade_samples;
+    }
+    else if (self->governor_load < GOVERNOR_RECOVER
+        && self->governor_level > 0) {
+        --self->governor_level;
+        self->governor_hold = self->rate;
+    }
+}
+
+
+/**
+* Main process function of the plugin.
+* \param instance  handle of the current plugin
+* \param n_samples number of samples in this current input block.
+*/
+static void run(LV2_Handle instance, uint32_t n_samples) {
+    BollieRetain* self = (BollieRetain*)instance;
+    struct timespec start;
+
+    if (self->record_file) {
+        record_block(self, n_samples);
+    }
+    // An empty block has nothing to render and no time to budget
+    if (!n_samples) {
+        return;
+    }
+
+    if (*self->ctl_cpu_budget > 0 && *self->ctl_freewheel <= 0) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+    }
+    else {
+        self->governor_level = 0;
+    }
+
+    // Control-rate work happens once per sub-block, events split it and
+    // apply at their frame
+    const LV2_Atom_Sequence* control = self->control;
+    const LV2_Atom_Event* ev = lv2_atom_sequence_begin(&control->body);
+    uint32_t offset = 0;
+    while (offset < n_samples) {
+        uint32_t end = n_samples - offset > CONTROL_LEN
+            ? offset + CONTROL_LEN : n_samples;
+        update_controls(self);
+        duck(self, offset, end - offset);
+
+        // A stage may stop early on a state change, the next one takes
+        // over within the sub-block
+        while (offset < end) {
+            uint32_t stop = end;
+            while (!lv2_atom_sequence_is_end(&control->body,
+                    control->atom.size, ev)) {
+                if (ev->time.frames > offset) {
+                    stop = ev->time.frames < end ? ev->time.frames : end;
+                    break;
+                }
+                handle_event(self, ev);
+                ev = lv2_atom_sequence_next(ev);
+            }
+
+            if (!self->looping && !self->listening) {
+                mix_dry(self, offset, stop - offset);
+                write_clock(self, offset, stop - offset, 0, 0);
+                offset = stop;
+                continue;
+            }
+
+            float phase = 0;
+            float step = loop_clock(self, &phase);
+            uint32_t n = render(self, offset, stop - offset);
+            if (!n) {
+                continue;
+            }
+            filter_wet(self, n);
+            mix(self, offset, n);
+            write_clock(self, offset, n, phase, step);
+            offset += n;
+        }
+    }
+    if (self->n_retired) {
+        release_tapes(self);
+    }
+    sync_tempo(self);
+
+    if (*self->ctl_cpu_budget > 0 && *self->ctl_freewheel <= 0) {
+        govern(self, n_samples, &start);
+    }
+}
+
+
+/**
+* Runs several instances on the scratch buffer of the calling thread.
+* \param instances instances to run
+* \param n_instances number of instances
+* \param n_samples number of samples in this block
+*/
+static void run_batch(LV2_Handle* instances, uint32_t n_instances,
+    uint32_t n_samples) {
+    static __thread Scratch scratch;
+
+    for (uint32_t i = 0 ; i < n_instances ; ++i) {
+        BollieRetain* self = (BollieRetain*)instances[i];
+
+        // Block state of the next instance loads while this one runs
+        if (i + 1 < n_instances) {
+            const char* next = (const char*)instances[i + 1];
+            for (size_t k = 0 ; k < offsetof(BollieRetain, grain_pos) ;
+                k += 64) {
+                __builtin_prefetch(next + k);
+            }
+        }
+
+        use_scratch(self, &scratch);
+        run(self, n_samples);
+        use_scratch(self, &self->own_scratch);
+    }
+}
+
+
+/**
+* Worker thread side, runs seam searches and bounces, frees own tapes and
+* writes out the recording.
+*/
+static LV2_Worker_Status work(LV2_Handle instance,
+    LV2_Worker_Respond_Function respond, LV2_Worker_Respond_Handle handle,
+    uint32_t size, const void* data) {
+    BollieRetain* self = (BollieRetain*)instance;
+    JobType type;
+
+    if (size < sizeof(JobType)) {
+        return LV2_WORKER_ERR_UNKNOWN;
+    }
+    memcpy(&type, data, sizeof(JobType));
+    if (type == JOB_FLUSH && self->record_file) {
+        flush_recording(self);
+        return LV2_WORKER_SUCCESS;
+    }
+    if (type == JOB_FREE && size == sizeof(FreeJob)) {
+        free(((const FreeJob*)data)->tape);
+        return LV2_WORKER_SUCCESS;
+    }
+    if (type == JOB_BANDS && size == sizeof(BandJob)) {
+        BandJob job = { JOB_BANDS,
+            calloc(BAND_TAPES * MAX_TAPE_LEN, sizeof(int16_t)) };
+        return respond(handle, sizeof(job), &job);
+    }
+    if (type == JOB_BOUNCE && size == sizeof(BounceJob)) {
+        BounceJob job = *(const BounceJob*)data;
+        job.n_grains = 0;
+        if (alloc_bounce(self)) {
+            bounce(self, &job);
+        }
+        return respond(handle, sizeof(job), &job);
+    }
+    if (type != JOB_SEAM || size != sizeof(SeamJob)) {
+        return LV2_WORKER_ERR_UNKNOWN;
+    }
+    SeamJob job = *(const SeamJob*)data;
+    find_seam(self, &job);
+    return respond(handle, sizeof(job), &job);
+}
+
+
+/**
+* Audio thread side, picks up the band tapes and the seam search or bounce
+* result. A result is applied at the next loop wrap, unless a newer
+* capture happened.
+*/
+static LV2_Worker_Status work_response(LV2_Handle instance, uint32_t size,
+    const void* data) {
+    BollieRetain* self = (BollieRetain*)instance;
+
+    if (self->record_file) {
+        uint8_t rec = BOLLIERETAIN_RECORD_RESPONSE;
+        record(self, &rec, 1);
+    }
+    if (size == sizeof(BandJob) && ((const BandJob*)data)->type == JOB_BANDS) {
+        // Captures use them from the next one on
+        self->band_arena = ((const BandJob*)data)->tapes;
+        return LV2_WORKER_SUCCESS;
+    }
+    if (size == sizeof(BounceJob)
+        && ((const BounceJob*)data)->type == JOB_BOUNCE) {
+        const BounceJob* job = (const BounceJob*)data;
+        self->bounce_busy = false;
+        if (job->n_grains == 0) {
+            return LV2_WORKER_SUCCESS;
+        }
+        if (job->generation == self->generation) {
+            self->bounce_take = job->take;
+            self->bounce_n_grains = job->n_grains;
+            self->bounce_pending = true;
+        }
+        else {
+            retire_tape(self, job->take.tape);
+        }
+        return LV2_WORKER_SUCCESS;
+    }
+    if (size != sizeof(SeamJob)) {
+        return LV2_WORKER_ERR_UNKNOWN;
+    }
+    const SeamJob* job = (const SeamJob*)data;
+    if (job->generation == self->generation) {
+        self->pending_loop_end = job->loop_end;
+        self->pending_n_seam_samples = job->n_seam_samples;
+        self->seam_pending = true;
+    }
+    return LV2_WORKER_SUCCESS;
+}
+
+
+/**
+* Called, when the host deactivates the plugin.
+*/
+static void deactivate(LV2_Handle instance) {
+}
+
+
+/**
+* Cleanup, freeing memory and stuff
+*/
+static void cleanup(LV2_Handle instance) {
+    BollieRetain* self = (BollieRetain*)instance;
+
+    if (self->record_file) {
+        flush_recording(self);
+        fclose(self->record_file);
+        free(self->record_ring);
+    }
+    free_tapes(self);
+    free(self->band_arena);
+    free(self->bounce_src);
+    free(instance);
+}
+
+
+/**
+* Tells which kernel variant an instance runs.
+*/
+static const char* kernel_variant(LV2_Handle instance) {
+    return ((BollieRetain*)instance)->kernels->name;
+}
+
+
+/**
+* extension stuff for additional interfaces
+*/
+static const void* extension_data(const char* uri) {
+    static const LV2_Worker_Interface worker = { work, work_response, NULL };
+    static const BollieRetain_Batch_Interface batch = { run_batch };
+    static const BollieRetain_Kernels_Interface kernels = { kernel_variant };
+    if (!strcmp(uri, LV2_WORKER__interface)) {
+        return &worker;
+    }
+    if (!strcmp(uri, BOLLIERETAIN__batch)) {
+        return &batch;
+    }
+    if (!strcmp(uri, BOLLIERETAIN__kernels)) {
+        return &kernels;
+    }
+    return NULL;
+}
+
+
+/**
+* Descriptor linking our methods.
+*/
+static const LV2_Descriptor descriptor = {
+    BOLLIERETAIN_URI,
+    instantiate,
+    connect_port,
+    activate,
+    run,
+    deactivate,
+    cleanup,
+    extension_data
+};
+
+
+/**
+* Descriptor of the split variant, same methods with the wet and dry
+* outputs declared.
+*/
+static const LV2_Descriptor split_descriptor = {
+    BOLLIERETAIN_SPLIT_URI,
     instantiate,
     connect_port,
     activate,
@@ -303,11 +3912,12 @@ static const LV2_Descriptor descriptor = {
 
 
 /**
-* Symbol export using the descriptor above
+* Symbol export using the descriptors above
 */
 LV2_SYMBOL_EXPORT const LV2_Descriptor* lv2_descriptor(uint32_t index) {
     switch (index) {
         case 0:  return &descriptor;
+        case 1:  return &split_descriptor;
         default: return NULL;
     }
 }
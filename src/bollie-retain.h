@@ -0,0 +1,122 @@
+/**
+    Bollie Retain - (c) 2016 Thomas Ebeling https://ca9.eu
+
+    This file is part of bollieretain.lv2
+
+    bollieretain.lv2 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    bollieretain.lv2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with bollieretain.lv2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+* \file bollie-retain.h
+* \author Bollie
+* \brief Extensions of the retainer for cooperating hosts
+*/
+
+#ifndef BOLLIERETAIN_H
+#define BOLLIERETAIN_H
+
+#include <stdint.h>
+
+#include "lv2/lv2plug.in/ns/lv2core/lv2.h"
+
+#define BOLLIERETAIN_URI "https://ca9.eu/lv2/bollieretain"
+/** Variant with separate wet and dry outputs for parallel routing */
+#define BOLLIERETAIN_SPLIT_URI BOLLIERETAIN_URI "-split"
+#define BOLLIERETAIN__batch BOLLIERETAIN_URI "#batch"
+#define BOLLIERETAIN__kernels BOLLIERETAIN_URI "#kernels"
+
+/**
+* Loop history messages.
+*
+* Atom objects without properties on the control port, the otype is one of
+* these. Undo steps back to the previous captured loop, or cancels a
+* running capture, redo steps forward again. The loop switches at the
+* frame of the event, no audio is copied.
+*/
+#define BOLLIERETAIN__undo BOLLIERETAIN_URI "#undo"
+#define BOLLIERETAIN__redo BOLLIERETAIN_URI "#redo"
+
+/**
+* Batch processing interface, returned by extension_data() for
+* BOLLIERETAIN__batch.
+*
+* A host running many retainers in the same cycle hands them over in one
+* call. The instances run back to back on one set of scratch buffers, so
+* these stay in cache, and the state of the next instance is prefetched.
+*/
+typedef struct {
+    /**
+    * Runs every instance for n_samples, same as calling run() on each.
+    * All instances must be retainers with their ports connected. The
+    * instances must not be run by another thread at the same time.
+    * \param instances instances to run, in this order
+    * \param n_instances number of instances
+    * \param n_samples number of samples in this block
+    */
+    void (*run_batch)(LV2_Handle* instances, uint32_t n_instances,
+        uint32_t n_samples);
+} BollieRetain_Batch_Interface;
+
+/**
+* Kernel variants.
+*
+* The hot loops are built for several instruction sets, every instance
+* runs the best one the CPU supports. BOLLIERETAIN_ISA in the environment
+* picks another supported one by name: "avx512", "avx2", "sse2" or "neon",
+* "generic" is always there. Returned by extension_data() for
+* BOLLIERETAIN__kernels.
+*/
+#define BOLLIERETAIN_ISA_ENV "BOLLIERETAIN_ISA"
+
+typedef struct {
+    /**
+    * \param instance retainer instance
+    * \return name of the kernel variant the instance runs
+    */
+    const char* (*variant)(LV2_Handle instance);
+} BollieRetain_Kernels_Interface;
+
+/**
+* Control input recording.
+*
+* With BOLLIERETAIN_RECORD set in the environment, every instance writes
+* its control input to "<value>.<instance number>". The file starts with
+* the magic "BRR1" and the sample rate as double, followed by records of a
+* tag byte and its payload, all in host byte order:
+*
+* - ACTIVATE: the host activated the instance
+* - CONTROL: control port changed, uint8 port index and float value
+* - EVENT: MIDI event of the next block, uint32 frame, uint8 size, data
+* - HISTORY: undo or redo message of the next block, uint32 frame and
+*   int8 step, -1 for undo and 1 for redo
+* - TEMPO: host tempo of the next block, uint32 frame and float BPM
+* - RESPONSE: a worker response was delivered before the next block
+* - BLOCK: run() was called, uint32 n_samples
+* - DROPPED: records lost to a full ring, uint32 count
+*/
+#define BOLLIERETAIN_RECORD_ENV "BOLLIERETAIN_RECORD"
+#define BOLLIERETAIN_RECORD_MAGIC "BRR1"
+
+typedef enum {
+    BOLLIERETAIN_RECORD_ACTIVATE    = 'A',
+    BOLLIERETAIN_RECORD_CONTROL     = 'C',
+    BOLLIERETAIN_RECORD_EVENT       = 'E',
+    BOLLIERETAIN_RECORD_HISTORY     = 'H',
+    BOLLIERETAIN_RECORD_TEMPO       = 'T',
+    BOLLIERETAIN_RECORD_RESPONSE    = 'R',
+    BOLLIERETAIN_RECORD_BLOCK       = 'B',
+    BOLLIERETAIN_RECORD_DROPPED     = 'D',
+} BollieRetain_Record_Tag;
+
+#endif
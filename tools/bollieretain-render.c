@@ -0,0 +1,485 @@
+/**
+    Bollie Retain - (c) 2016 Thomas Ebeling https://ca9.eu
+
+    This file is part of bollieretain.lv2
+
+    bollieretain.lv2 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    bollieretain.lv2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with bollieretain.lv2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+* \file bollieretain-render.c
+* \author Bollie
+* \brief Offline batch renderer running the plugin over WAV files
+*
+* Every input file is rendered by its own plugin instance, files are spread
+* over a pool of threads. Controls follow an automation script of
+* "<seconds> <port> <value>" lines, events are applied at their exact
+* sample by splitting the run calls.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "host.h"
+
+#define RUN_LEN 4096            ///< Maximum frames per run call
+#define MAX_EVENTS 4096         ///< Capacity of the automation script
+
+/**
+* A control change of the automation script.
+*/
+typedef struct {
+    double time;                ///< Time in seconds from the start
+    uint32_t port;              ///< Port index
+    float value;                ///< New control value
+    uint32_t order;             ///< Position in the script
+} Event;
+
+static const LV2_Descriptor* descriptor;
+
+static Event events[MAX_EVENTS];
+static uint32_t n_events;
+static float initial[HOST_N_PORTS];
+
+static char** inputs;
+static uint32_t n_inputs;
+static uint32_t next_input;
+static uint32_t n_failed;
+static const char* out_dir = ".";
+static double tail_seconds;
+
+
+/**
+* Reads a little endian integer.
+*/
+static uint32_t read_le(const uint8_t* data, int n_bytes) {
+    uint32_t value = 0;
+
+    for (int i = n_bytes - 1 ; i >= 0 ; --i) {
+        value = (value << 8) | data[i];
+    }
+    return value;
+}
+
+
+/**
+* Loads a PCM or float WAV file as two deinterleaved channels, mono files
+* are duplicated to both.
+* \param path file to load
+* \param rate receives the sample rate
+* \param n_frames receives the length in frames
+* \return left channel followed by the right channel or NULL on failure
+*/
+static float* load_wav(const char* path, double* rate, uint64_t* n_frames) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "%s: cannot open\n", path);
+        return NULL;
+    }
+
+    uint8_t header[12];
+    if (fread(header, 1, 12, file) != 12 || memcmp(header, "RIFF", 4)
+        || memcmp(header + 8, "WAVE", 4)) {
+        fprintf(stderr, "%s: not a WAV file\n", path);
+        fclose(file);
+        return NULL;
+    }
+
+    uint32_t format = 0;
+    uint32_t n_channels = 0;
+    uint32_t n_bits = 0;
+    uint8_t chunk[8];
+    float* audio = NULL;
+
+    while (fread(chunk, 1, 8, file) == 8) {
+        uint32_t size = read_le(chunk + 4, 4);
+
+        if (!memcmp(chunk, "fmt ", 4)) {
+            uint8_t fmt[40] = {0};
+            if (size < 16 || fread(fmt, 1, size < 40 ? size : 40, file)
+                != (size < 40 ? size : 40)) {
+                break;
+            }
+            format = read_le(fmt, 2);
+            n_channels = read_le(fmt + 2, 2);
+            *rate = read_le(fmt + 4, 4);
+            n_bits = read_le(fmt + 14, 2);
+
+            // WAVE_FORMAT_EXTENSIBLE keeps the format in the sub format
+            if (format == 0xfffe && size >= 26) {
+                format = read_le(fmt + 24, 2);
+            }
+            if (size > 40) {
+                fseek(file, size - 40, SEEK_CUR);
+            }
+        }
+        else if (!memcmp(chunk, "data", 4) && n_channels) {
+            if (!((format == 1 && (n_bits == 16 || n_bits == 24
+                || n_bits == 32)) || (format == 3 && n_bits == 32))) {
+                fprintf(stderr, "%s: unsupported sample format\n", path);
+                break;
+            }
+
+            uint32_t frame_size = n_channels * n_bits / 8;
+            uint8_t* raw = malloc(size);
+            size = fread(raw, 1, size, file);
+            *n_frames = size / frame_size;
+            audio = malloc(2 * *n_frames * sizeof(float) + 1);
+
+            for (uint64_t i = 0 ; i < *n_frames ; ++i) {
+                for (uint32_t c = 0 ; c < 2 ; ++c) {
+                    const uint8_t* s = raw + i * frame_size
+                        + (c < n_channels ? c : 0) * n_bits / 8;
+                    float value;
+
+                    if (format == 3) {
+                        memcpy(&value, s, sizeof(float));
+                    }
+                    else {
+                        // Shift up to 32 bit for the sign
+                        int32_t v = read_le(s, n_bits / 8) << (32 - n_bits);
+                        value = v / 2147483648.0f;
+                    }
+                    audio[c * *n_frames + i] = value;
+                }
+            }
+            free(raw);
+            break;
+        }
+        else {
+            fseek(file, size + (size & 1), SEEK_CUR);
+        }
+    }
+    fclose(file);
+
+    if (!audio) {
+        fprintf(stderr, "%s: no audio data\n", path);
+    }
+    return audio;
+}
+
+
+/**
+* Writes a stereo 32 bit float WAV file.
+* \param path file to write
+* \param rate sample rate
+* \param audio left channel followed by the right channel
+* \param n_frames length in frames
+* \return true on success
+*/
+static bool save_wav(const char* path, double rate, const float* audio,
+    uint64_t n_frames) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "%s: cannot create\n", path);
+        return false;
+    }
+
+    uint32_t data_size = n_frames * 2 * sizeof(float);
+    uint32_t header[11] = {
+        0x46464952, 36 + data_size, 0x45564157,     // RIFF size WAVE
+        0x20746d66, 16, 0x00020003, (uint32_t)rate, // fmt, float, stereo
+        (uint32_t)rate * 8, 0x00200008,             // byte rate, align, bits
+        0x61746164, data_size,                      // data size
+    };
+    bool ok = fwrite(header, sizeof(header), 1, file) == 1;
+
+    float frame[2];
+    for (uint64_t i = 0 ; ok && i < n_frames ; ++i) {
+        frame[0] = audio[i];
+        frame[1] = audio[n_frames + i];
+        ok = fwrite(frame, sizeof(frame), 1, file) == 1;
+    }
+    ok = !fclose(file) && ok;
+
+    if (!ok) {
+        fprintf(stderr, "%s: write failed\n", path);
+    }
+    return ok;
+}
+
+
+/**
+* Returns the sample position of a script event.
+*/
+static uint64_t event_frame(uint32_t ev, double rate) {
+    return (uint64_t)llround(events[ev].time * rate);
+}
+
+
+/**
+* Renders one input file through a fresh plugin instance.
+* \param path input file
+* \return true on success
+*/
+static bool render_file(const char* path) {
+    const char* name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    char* out_path = malloc(strlen(out_dir) + strlen(name) + 2);
+    sprintf(out_path, "%s/%s", out_dir, name);
+
+    // Rendering next to the input would overwrite it
+    struct stat in_stat, out_stat;
+    if (!stat(path, &in_stat) && !stat(out_path, &out_stat)
+        && in_stat.st_dev == out_stat.st_dev
+        && in_stat.st_ino == out_stat.st_ino) {
+        fprintf(stderr, "%s: output would overwrite the input, use -o\n",
+            path);
+        free(out_path);
+        return false;
+    }
+
+    double rate = 0;
+    uint64_t n_in = 0;
+    float* in = load_wav(path, &rate, &n_in);
+    if (!in) {
+        free(out_path);
+        return false;
+    }
+
+    HostInstance* host = malloc(sizeof(HostInstance));
+    if (!host_instantiate(host, descriptor, rate, initial, true)) {
+        fprintf(stderr, "%s: cannot instantiate the plugin\n", path);
+        free(host);
+        free(in);
+        free(out_path);
+        return false;
+    }
+
+    uint64_t n_out = n_in + (uint64_t)(tail_seconds * rate);
+    float* out = malloc(2 * n_out * sizeof(float) + 1);
+
+    float in_l[RUN_LEN], in_r[RUN_LEN], out_l[RUN_LEN], out_r[RUN_LEN];
+    descriptor->connect_port(host->instance, 2, in_l);
+    descriptor->connect_port(host->instance, 3, in_r);
+    descriptor->connect_port(host->instance, 4, out_l);
+    descriptor->connect_port(host->instance, 5, out_r);
+
+    uint32_t ev = 0;
+    uint64_t pos = 0;
+    while (pos < n_out) {
+        while (ev < n_events && event_frame(ev, rate) <= pos) {
+            host->control[events[ev].port] = events[ev].value;
+            ev++;
+        }
+
+        // Runs end at the next event for sample accurate automation
+        uint64_t n = n_out - pos;
+        if (n > RUN_LEN) {
+            n = RUN_LEN;
+        }
+        if (ev < n_events && event_frame(ev, rate) < pos + n) {
+            n = event_frame(ev, rate) - pos;
+        }
+
+        for (uint64_t i = 0 ; i < n ; ++i) {
+            in_l[i] = pos + i < n_in ? in[pos + i] : 0;
+            in_r[i] = pos + i < n_in ? in[n_in + pos + i] : 0;
+        }
+
+        descriptor->run(host->instance, n);
+        host_run_work(host);
+
+        memcpy(out + pos, out_l, n * sizeof(float));
+        memcpy(out + n_out + pos, out_r, n * sizeof(float));
+        pos += n;
+    }
+
+    host_cleanup(host);
+    free(host);
+
+    bool ok = save_wav(out_path, rate, out, n_out);
+
+    free(out_path);
+    free(out);
+    free(in);
+    return ok;
+}
+
+
+/**
+* Thread pool worker, takes files until none are left.
+*/
+static void* render_thread(void* arg) {
+    uint32_t i;
+
+    while ((i = __atomic_fetch_add(&next_input, 1, __ATOMIC_RELAXED))
+        < n_inputs) {
+        if (!render_file(inputs[i])) {
+            __atomic_fetch_add(&n_failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+
+/**
+* Orders events by time, keeping the script order for equal times.
+*/
+static int compare_events(const void* a, const void* b) {
+    const Event* ea = a;
+    const Event* eb = b;
+
+    if (ea->time != eb->time) {
+        return ea->time < eb->time ? -1 : 1;
+    }
+    return ea->order < eb->order ? -1 : 1;
+}
+
+
+/**
+* Parses the automation script.
+* \param path script file
+* \return true on success
+*/
+static bool load_script(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "%s: cannot open\n", path);
+        return false;
+    }
+
+    char line[256];
+    char name[64];
+    uint32_t n_line = 0;
+    bool ok = true;
+
+    while (ok && fgets(line, sizeof(line), file)) {
+        Event e;
+        n_line++;
+
+        char* comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+        if (strspn(line, " \t\r\n") == strlen(line)) {
+            continue;
+        }
+
+        if (sscanf(line, "%lf %63s %f", &e.time, name, &e.value) != 3
+            || e.time < 0 || host_find_port(name) < 0) {
+            fprintf(stderr, "%s:%u: expected <seconds> <port> <value>\n",
+                path, n_line);
+            ok = false;
+        }
+        else if (n_events == MAX_EVENTS) {
+            fprintf(stderr, "%s: more than %d events\n", path, MAX_EVENTS);
+            ok = false;
+        }
+        else {
+            e.port = host_find_port(name);
+            e.order = n_events;
+            events[n_events++] = e;
+        }
+    }
+    fclose(file);
+
+    qsort(events, n_events, sizeof(Event), compare_events);
+    return ok;
+}
+
+
+static void usage(const char* name) {
+    fprintf(stderr,
+        "Usage: %s [options] input.wav...\n"
+        "  -o DIR           output directory, default .\n"
+        "  -s FILE          automation script of <seconds> <port> <value>\n"
+        "  -p PORT=VALUE    initial control value, by symbol or index\n"
+        "  -t SECONDS       render past the end of the input\n"
+        "  -j THREADS       parallel renders, default one per core\n",
+        name);
+}
+
+
+int main(int argc, char** argv) {
+    long n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+
+    for (int p = 0 ; p < HOST_N_PORTS ; ++p) {
+        initial[p] = host_ports[p].value;
+    }
+    // Rendering offline is freewheeling
+    initial[host_find_port("freewheel")] = 1.0f;
+
+    while ((opt = getopt(argc, argv, "o:s:p:t:j:h")) != -1) {
+        char* value;
+
+        switch (opt) {
+        case 'o':
+            out_dir = optarg;
+            break;
+        case 's':
+            if (!load_script(optarg)) {
+                return 1;
+            }
+            break;
+        case 'p':
+            value = strchr(optarg, '=');
+            if (value) {
+                *value++ = '\0';
+            }
+            if (!value || host_find_port(optarg) < 0) {
+                fprintf(stderr, "Unknown control '%s'\n", optarg);
+                return 1;
+            }
+            initial[host_find_port(optarg)] = atof(value);
+            break;
+        case 't':
+            tail_seconds = fmax(atof(optarg), 0);
+            break;
+        case 'j':
+            n_threads = atol(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    inputs = argv + optind;
+    n_inputs = argc - optind;
+    if (!n_inputs) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    descriptor = lv2_descriptor(0);
+    if (n_threads < 1) {
+        n_threads = 1;
+    }
+    if (n_threads > n_inputs) {
+        n_threads = n_inputs;
+    }
+
+    pthread_t threads[n_threads];
+    for (long t = 0 ; t < n_threads ; ++t) {
+        pthread_create(&threads[t], NULL, render_thread, NULL);
+    }
+    for (long t = 0 ; t < n_threads ; ++t) {
+        pthread_join(threads[t], NULL);
+    }
+
+    if (n_failed) {
+        fprintf(stderr, "%u of %u files failed\n", n_failed, n_inputs);
+        return 1;
+    }
+    return 0;
+}
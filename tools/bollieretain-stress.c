@@ -0,0 +1,707 @@
+/**
+    Bollie Retain - (c) 2016 Thomas Ebeling https://ca9.eu
+
+    This file is part of bollieretain.lv2
+
+    bollieretain.lv2 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    bollieretain.lv2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with bollieretain.lv2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+* \file bollieretain-stress.c
+* \author Bollie
+* \brief Multi-instance scaling harness
+*
+* Runs many instances in cycles like a host would, optionally spread over
+* threads that meet at a barrier after every cycle. Reports throughput,
+* worst cycle time against the real time budget, resident memory per
+* instance and hardware cache counters where perf events are available.
+*
+* With -R a recording of BOLLIERETAIN_RECORD is replayed instead, with the
+* recorded block sizes, controls, events and worker response timing.
+*
+* With -w the output of the first instance is written to a file, with -c
+* it is compared to such a file, so kernel variants can be checked against
+* each other. -S hosts the split variant with all outputs connected, -I
+* runs in place, the input handed in the buffer of an output pair.
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "lv2/lv2plug.in/ns/ext/midi/midi.h"
+#include "lv2/lv2plug.in/ns/ext/time/time.h"
+
+#include "bollie-retain.h"
+#include "host.h"
+
+#define MAX_INSTANCES 256       ///< Upper limit of hosted instances
+#define MAX_BLOCK_LEN 8192      ///< Upper limit of the block size
+#define N_COUNTERS 4            ///< Hardware counters to read
+#define CHECK_TOLERANCE 1e-4f   ///< Largest deviation accepted by -c
+
+/**
+* Per thread share of the instances and its cycle times.
+*/
+typedef struct {
+    pthread_t thread;
+    uint32_t first;             ///< First instance of this thread
+    uint32_t n;                 ///< Number of instances of this thread
+    double* cycle_time;         ///< Run time of every cycle in seconds
+} Worker;
+
+static const LV2_Descriptor* descriptor;
+static HostInstance* hosts[MAX_INSTANCES];
+static LV2_Handle handles[MAX_INSTANCES];
+static const BollieRetain_Batch_Interface* batch;
+static float* outputs[MAX_INSTANCES];    ///< Output pairs, block by block
+static float input_l[MAX_BLOCK_LEN];
+static float input_r[MAX_BLOCK_LEN];
+
+static uint32_t n_instances = 16;
+static uint32_t n_threads = 1;
+static uint32_t block_len = 256;
+static uint32_t n_cycles;
+static double rate = 48000;
+static double seconds = 10;
+static pthread_barrier_t barrier;
+static float* take;             ///< Output of the first instance, or NULL
+static uint32_t n_channels = 2; ///< Outputs per instance, 6 when split
+static int in_place = -1;       ///< Output pair holding the input, or -1
+static uint32_t n_notes;        ///< Sampler notes held from one second on
+static LV2_URID midi_event;     ///< URID of midi:MidiEvent
+
+static const struct {
+    const char* name;
+    uint32_t type;
+    uint64_t config;
+} counters[N_COUNTERS] = {
+    {"cache references", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES},
+    {"cache misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"L1d loads", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+        | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+        | (PERF_COUNT_HW_CACHE_RESULT_ACCESS << 16)},
+    {"L1d load misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+        | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+        | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+};
+
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/**
+* Returns the resident set size of the process in bytes.
+*/
+static double resident_bytes(void) {
+    long pages = 0;
+    FILE* file = fopen("/proc/self/statm", "r");
+
+    if (file) {
+        if (fscanf(file, "%*d %ld", &pages) != 1) {
+            pages = 0;
+        }
+        fclose(file);
+    }
+    return (double)pages * sysconf(_SC_PAGESIZE);
+}
+
+
+/**
+* Opens a disabled counter for this process and all threads created later.
+* \return file descriptor or -1 when not available
+*/
+static int open_counter(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+
+/**
+* Host cycle loop of one thread. Worker jobs are done after the timed part,
+* as a host hands them to a separate thread.
+*/
+static void* run_thread(void* arg) {
+    Worker* worker = (Worker*)arg;
+    uint32_t end = worker->first + worker->n;
+
+    for (uint32_t c = 0 ; c < n_cycles ; ++c) {
+        pthread_barrier_wait(&barrier);
+
+        // Staggered triggers keep the seam searches apart, in place hosts
+        // hand the input over in an output buffer
+        // Sampler notes come in one per cycle once the loops run
+        uint32_t note = c - (uint32_t)(rate / block_len);
+        for (uint32_t i = worker->first ; i < end ; ++i) {
+            hosts[i]->control[1] = c == 1 + i % 16;
+            if (note < n_notes) {
+                uint8_t on[3] = { 0x90, 48 + note, 100 };
+                host_append_event(hosts[i], 0, midi_event, 3, on);
+            }
+            if (in_place >= 0) {
+                float* pair = outputs[i] + 2 * block_len * in_place;
+                memcpy(pair, input_l, block_len * sizeof(float));
+                memcpy(pair + block_len, input_r, block_len * sizeof(float));
+            }
+        }
+
+        double start = now();
+        if (batch) {
+            batch->run_batch(handles + worker->first, worker->n, block_len);
+        }
+        else {
+            for (uint32_t i = worker->first ; i < end ; ++i) {
+                descriptor->run(hosts[i]->instance, block_len);
+            }
+        }
+        worker->cycle_time[c] = now() - start;
+
+        if (take && worker->first == 0) {
+            memcpy(take + n_channels * block_len * c, outputs[0],
+                n_channels * block_len * sizeof(float));
+        }
+
+        for (uint32_t i = worker->first ; i < end ; ++i) {
+            host_run_work(hosts[i]);
+            lv2_atom_sequence_clear(&hosts[i]->sequence);
+        }
+    }
+    return NULL;
+}
+
+
+/**
+* Replays a control input recording on a single instance. The input is a
+* fixed sine, so equal recordings give equal output and the same checksum.
+* \param path recording to replay
+* \return 0 on success
+*/
+static int replay(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "%s: cannot open\n", path);
+        return 1;
+    }
+
+    char magic[4];
+    double rec_rate;
+    if (fread(magic, 4, 1, file) != 1 || fread(&rec_rate, sizeof(double), 1,
+        file) != 1 || memcmp(magic, BOLLIERETAIN_RECORD_MAGIC, 4)) {
+        fprintf(stderr, "%s: not a recording\n", path);
+        fclose(file);
+        return 1;
+    }
+
+    HostInstance* host = malloc(sizeof(HostInstance));
+    // Activation is part of the recording
+    if (!host_instantiate(host, descriptor, rec_rate, NULL, false)) {
+        fprintf(stderr, "Cannot instantiate the plugin\n");
+        fclose(file);
+        return 1;
+    }
+    LV2_URID atom_object = host_map_uri(NULL, LV2_ATOM__Object);
+    LV2_URID msg_undo = host_map_uri(NULL, BOLLIERETAIN__undo);
+    LV2_URID msg_redo = host_map_uri(NULL, BOLLIERETAIN__redo);
+    LV2_URID atom_float = host_map_uri(NULL, LV2_ATOM__Float);
+    LV2_URID time_position = host_map_uri(NULL, LV2_TIME__Position);
+    LV2_URID time_bpm = host_map_uri(NULL, LV2_TIME__beatsPerMinute);
+
+    float in_l[MAX_BLOCK_LEN], in_r[MAX_BLOCK_LEN];
+    float out_l[MAX_BLOCK_LEN], out_r[MAX_BLOCK_LEN];
+    descriptor->connect_port(host->instance, 2, in_l);
+    descriptor->connect_port(host->instance, 3, in_r);
+    descriptor->connect_port(host->instance, 4, out_l);
+    descriptor->connect_port(host->instance, 5, out_r);
+
+    uint64_t n_blocks = 0;
+    uint64_t pos = 0;
+    uint32_t n_missing = 0;
+    uint32_t n_dropped = 0;
+    uint32_t checksum = 2166136261u;
+    double total = 0;
+    double worst = 0;
+    double worst_budget = 0;
+    bool ok = true;
+    int tag;
+
+    while (ok && (tag = fgetc(file)) != EOF) {
+        uint8_t port;
+        uint8_t size;
+        int8_t step;
+        uint8_t data[256];
+        uint32_t value;
+        float control;
+
+        switch (tag) {
+        case BOLLIERETAIN_RECORD_ACTIVATE:
+            host_activate(host);
+            break;
+        case BOLLIERETAIN_RECORD_CONTROL:
+            ok = fread(&port, 1, 1, file) == 1
+                && fread(&control, sizeof(float), 1, file) == 1
+                && port < HOST_N_PORTS;
+            if (ok) {
+                host->control[port] = control;
+            }
+            break;
+        case BOLLIERETAIN_RECORD_EVENT:
+            ok = fread(&value, sizeof(uint32_t), 1, file) == 1
+                && fread(&size, 1, 1, file) == 1
+                && fread(data, 1, size, file) == size;
+            if (ok) {
+                host_append_event(host, value, midi_event, size, data);
+            }
+            break;
+        case BOLLIERETAIN_RECORD_HISTORY:
+            ok = fread(&value, sizeof(uint32_t), 1, file) == 1
+                && fread(&step, 1, 1, file) == 1;
+            if (ok) {
+                LV2_Atom_Object_Body body = {
+                    0, step < 0 ? msg_undo : msg_redo
+                };
+                host_append_event(host, value, atom_object, sizeof(body),
+                    &body);
+            }
+            break;
+        case BOLLIERETAIN_RECORD_TEMPO:
+            ok = fread(&value, sizeof(uint32_t), 1, file) == 1
+                && fread(&control, sizeof(float), 1, file) == 1;
+            if (ok) {
+                struct {
+                    LV2_Atom_Object_Body body;
+                    LV2_Atom_Property_Body bpm;
+                    float value;
+                } position = {
+                    { 0, time_position },
+                    { time_bpm, 0, { sizeof(float), atom_float } },
+                    control
+                };
+                host_append_event(host, value, atom_object, sizeof(position),
+                    &position);
+            }
+            break;
+        case BOLLIERETAIN_RECORD_RESPONSE:
+            if (!host_deliver_response(host)) {
+                n_missing++;
+            }
+            break;
+        case BOLLIERETAIN_RECORD_DROPPED:
+            ok = fread(&value, sizeof(uint32_t), 1, file) == 1;
+            n_dropped += value;
+            break;
+        case BOLLIERETAIN_RECORD_BLOCK:
+            ok = fread(&value, sizeof(uint32_t), 1, file) == 1
+                && value <= MAX_BLOCK_LEN;
+            if (!ok) {
+                break;
+            }
+            for (uint32_t i = 0 ; i < value ; ++i) {
+                in_l[i] = 0.5f * sinf(2.0f * M_PI * 220.0f * pos / rec_rate);
+                in_r[i] = 0.5f * sinf(2.0f * M_PI * 330.0f * pos / rec_rate);
+                pos++;
+            }
+
+            double start = now();
+            descriptor->run(host->instance, value);
+            double elapsed = now() - start;
+            total += elapsed;
+            if (elapsed > worst) {
+                worst = elapsed;
+                worst_budget = value / rec_rate;
+            }
+            n_blocks++;
+
+            // Responses wait for their recorded block
+            host_do_work(host);
+            lv2_atom_sequence_clear(&host->sequence);
+
+            // FNV-1a over the output bits
+            for (uint32_t i = 0 ; i < value ; ++i) {
+                uint32_t bits[2];
+                memcpy(&bits[0], &out_l[i], sizeof(float));
+                memcpy(&bits[1], &out_r[i], sizeof(float));
+                checksum = (checksum ^ bits[0]) * 16777619u;
+                checksum = (checksum ^ bits[1]) * 16777619u;
+            }
+            break;
+        default:
+            ok = false;
+            break;
+        }
+    }
+    fclose(file);
+    host_cleanup(host);
+    free(host);
+
+    if (!ok) {
+        fprintf(stderr, "%s: broken record after %llu blocks\n", path,
+            (unsigned long long)n_blocks);
+        return 1;
+    }
+
+    printf("replayed           %llu blocks, %.1f s at %.0f Hz\n",
+        (unsigned long long)n_blocks, pos / rec_rate, rec_rate);
+    if (n_blocks) {
+        printf("mean block         %.3f ms, %.1f %% load\n",
+            total / n_blocks * 1e3, total / (pos / rec_rate) * 100);
+        printf("worst block        %.3f ms, %.1f %% load\n", worst * 1e3,
+            worst / worst_budget * 100);
+    }
+    printf("output checksum    %08x\n", checksum);
+    if (n_dropped) {
+        printf("dropped records    %u, replay is incomplete\n", n_dropped);
+    }
+    if (n_missing) {
+        printf("missing responses  %u\n", n_missing);
+    }
+    return 0;
+}
+
+
+/**
+* Writes the outputs of the first instance, left and right of each pair
+* block by block.
+* \param path file to write
+* \return 0 on success
+*/
+static int write_take(const char* path) {
+    FILE* file = fopen(path, "wb");
+    size_t n = (size_t)n_channels * block_len * n_cycles;
+
+    if (!file || fwrite(take, sizeof(float), n, file) != n) {
+        fprintf(stderr, "%s: cannot write\n", path);
+        if (file) {
+            fclose(file);
+        }
+        return 1;
+    }
+    fclose(file);
+    return 0;
+}
+
+
+/**
+* Compares the output of the first instance to one written by -w with the
+* same options.
+* \param path file to compare to
+* \return 0 if no sample deviates by more than CHECK_TOLERANCE
+*/
+static int compare_take(const char* path) {
+    FILE* file = fopen(path, "rb");
+    size_t n = (size_t)n_channels * block_len * n_cycles;
+    float* reference = malloc(n * sizeof(float));
+
+    if (!file || fread(reference, sizeof(float), n, file) != n
+        || fgetc(file) != EOF) {
+        fprintf(stderr, "%s: missing or of another length\n", path);
+        if (file) {
+            fclose(file);
+        }
+        free(reference);
+        return 1;
+    }
+    fclose(file);
+
+    float deviation = 0;
+    size_t worst = 0;
+    for (size_t i = 0 ; i < n ; ++i) {
+        float d = fabsf(take[i] - reference[i]);
+        if (d > deviation) {
+            deviation = d;
+            worst = i;
+        }
+    }
+    free(reference);
+
+    printf("deviation          %.3g at %.3f s\n", deviation,
+        worst / (n_channels * block_len) * block_len / rate);
+    return deviation > CHECK_TOLERANCE;
+}
+
+
+static void usage(const char* name) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  -n INSTANCES     hosted instances, 1 to %d, default 16\n"
+        "  -j THREADS       host threads, default 1\n"
+        "  -b FRAMES        block size, default 256\n"
+        "  -r RATE          sample rate, default 48000\n"
+        "  -s SECONDS       rendered time, default 10\n"
+        "  -p PORT=VALUE    control value for all instances\n"
+        "  -B               run each thread's instances as one batch\n"
+        "  -R FILE          replay a control input recording\n"
+        "  -w FILE          write the output of the first instance\n"
+        "  -c FILE          compare it to one written by -w\n"
+        "  -S               host the split variant, all outputs connected\n"
+        "  -I PAIR          run in place, the input in out, wet or dry\n"
+        "  -N NOTES         sampler notes to hold, struck from 1 s on\n",
+        name, MAX_INSTANCES);
+}
+
+
+int main(int argc, char** argv) {
+    float initial[HOST_N_PORTS];
+    bool use_batch = false;
+    const char* replay_path = NULL;
+    const char* write_path = NULL;
+    const char* compare_path = NULL;
+    int opt;
+
+    for (int p = 0 ; p < HOST_N_PORTS ; ++p) {
+        initial[p] = host_ports[p].value;
+    }
+    initial[0] = 50.0f;
+
+    while ((opt = getopt(argc, argv, "n:j:b:r:s:p:BR:w:c:SI:N:h")) != -1) {
+        char* value;
+
+        switch (opt) {
+        case 'n':
+            n_instances = atoi(optarg);
+            break;
+        case 'j':
+            n_threads = atoi(optarg);
+            break;
+        case 'b':
+            block_len = atoi(optarg);
+            break;
+        case 'r':
+            rate = atof(optarg);
+            break;
+        case 's':
+            seconds = atof(optarg);
+            break;
+        case 'p':
+            value = strchr(optarg, '=');
+            if (value) {
+                *value++ = '\0';
+            }
+            if (!value || host_find_port(optarg) < 0) {
+                fprintf(stderr, "Unknown control '%s'\n", optarg);
+                return 1;
+            }
+            initial[host_find_port(optarg)] = atof(value);
+            break;
+        case 'B':
+            use_batch = true;
+            break;
+        case 'R':
+            replay_path = optarg;
+            break;
+        case 'w':
+            write_path = optarg;
+            break;
+        case 'c':
+            compare_path = optarg;
+            break;
+        case 'S':
+            n_channels = 6;
+            break;
+        case 'I':
+            in_place = !strcmp(optarg, "out") ? 0 : !strcmp(optarg, "wet")
+                ? 1 : !strcmp(optarg, "dry") ? 2 : 3;
+            break;
+        case 'N':
+            n_notes = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (n_instances < 1 || n_instances > MAX_INSTANCES || n_threads < 1
+        || block_len < 1 || block_len > MAX_BLOCK_LEN || rate <= 0
+        || (uint32_t)(in_place + 1) > n_channels / 2 || n_notes > 80) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (n_threads > n_instances) {
+        n_threads = n_instances;
+    }
+    n_cycles = ceil(seconds * rate / block_len);
+
+    // The same block is fed every cycle, so it holds whole periods
+    float periods = fmaxf(roundf(220.0f * block_len / rate), 1.0f);
+    for (uint32_t i = 0 ; i < block_len ; ++i) {
+        input_l[i] = 0.5f * sinf(2.0f * M_PI * periods * i / block_len);
+        input_r[i] = 0.5f * sinf(4.0f * M_PI * periods * i / block_len);
+    }
+
+    descriptor = lv2_descriptor(n_channels > 2 ? 1 : 0);
+    midi_event = host_map_uri(NULL, LV2_MIDI__MidiEvent);
+    if (replay_path) {
+        return replay(replay_path);
+    }
+    if (use_batch) {
+        batch = descriptor->extension_data(BOLLIERETAIN__batch);
+        if (!batch) {
+            fprintf(stderr, "The plugin has no batch interface\n");
+            return 1;
+        }
+    }
+
+    if (write_path || compare_path) {
+        take = malloc((size_t)n_channels * block_len * n_cycles
+            * sizeof(float));
+    }
+
+    double resident = resident_bytes();
+    for (uint32_t i = 0 ; i < n_instances ; ++i) {
+        hosts[i] = malloc(sizeof(HostInstance));
+        outputs[i] = malloc(n_channels * block_len * sizeof(float));
+        if (!host_instantiate(hosts[i], descriptor, rate, initial, true)) {
+            fprintf(stderr, "Cannot instantiate the plugin\n");
+            return 1;
+        }
+        handles[i] = hosts[i]->instance;
+
+        // Mixed output, then wet and dry of the split variant
+        static const uint32_t pair_port[3] = { 4, 40, 42 };
+        for (uint32_t k = 0 ; k < n_channels ; ++k) {
+            descriptor->connect_port(hosts[i]->instance,
+                pair_port[k / 2] + k % 2, outputs[i] + k * block_len);
+        }
+        float* in = in_place >= 0 ? outputs[i] + 2 * block_len * in_place
+            : NULL;
+        descriptor->connect_port(hosts[i]->instance, 2, in ? in : input_l);
+        descriptor->connect_port(hosts[i]->instance, 3,
+            in ? in + block_len : input_r);
+    }
+    resident = (resident_bytes() - resident) / n_instances;
+
+    // A variant the CPU lacks falls back to another one, skip the run
+    // rather than measure that one under the wrong name
+    const BollieRetain_Kernels_Interface* kernels =
+        descriptor->extension_data(BOLLIERETAIN__kernels);
+    const char* isa = getenv(BOLLIERETAIN_ISA_ENV);
+    if (kernels && isa && strcmp(isa, "generic")
+        && strcmp(isa, kernels->variant(handles[0]))) {
+        printf("kernels            %s unavailable, skipped\n", isa);
+        return 0;
+    }
+
+    int counter_fd[N_COUNTERS];
+    for (int k = 0 ; k < N_COUNTERS ; ++k) {
+        counter_fd[k] = open_counter(counters[k].type, counters[k].config);
+        if (counter_fd[k] >= 0) {
+            ioctl(counter_fd[k], PERF_EVENT_IOC_RESET, 0);
+            ioctl(counter_fd[k], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    // Instances are split evenly in contiguous runs over the threads
+    Worker workers[n_threads];
+    pthread_barrier_init(&barrier, NULL, n_threads);
+    double start = now();
+    for (uint32_t t = 0 ; t < n_threads ; ++t) {
+        workers[t].first = t * n_instances / n_threads;
+        workers[t].n = (t + 1) * n_instances / n_threads - workers[t].first;
+        workers[t].cycle_time = calloc(n_cycles, sizeof(double));
+        pthread_create(&workers[t].thread, NULL, run_thread, &workers[t]);
+    }
+    for (uint32_t t = 0 ; t < n_threads ; ++t) {
+        pthread_join(workers[t].thread, NULL);
+    }
+    double wall = now() - start;
+
+    // A cycle is done when its slowest thread is
+    double budget = block_len / rate;
+    double total = 0;
+    double worst = 0;
+    for (uint32_t c = 0 ; c < n_cycles ; ++c) {
+        double cycle = 0;
+        for (uint32_t t = 0 ; t < n_threads ; ++t) {
+            cycle = fmax(cycle, workers[t].cycle_time[c]);
+        }
+        total += cycle;
+        worst = fmax(worst, cycle);
+    }
+
+    printf("instances          %u on %u threads%s\n", n_instances,
+        n_threads, batch ? ", batched" : "");
+    printf("block              %u frames, %.3f ms budget\n", block_len,
+        budget * 1e3);
+    if (kernels) {
+        printf("kernels            %s\n", kernels->variant(handles[0]));
+    }
+    printf("resident/instance  %.1f kB\n", resident / 1024);
+    printf("throughput         %.1f x realtime, %.1f instance seconds/s\n",
+        n_cycles * budget / total, n_instances * n_cycles * budget / wall);
+    printf("mean cycle         %.3f ms, %.1f %% load\n",
+        total / n_cycles * 1e3, total / n_cycles / budget * 100);
+    printf("worst cycle        %.3f ms, %.1f %% load\n", worst * 1e3,
+        worst / budget * 100);
+
+    uint64_t count[N_COUNTERS];
+    for (int k = 0 ; k < N_COUNTERS ; ++k) {
+        if (counter_fd[k] < 0 || read(counter_fd[k], &count[k],
+            sizeof(uint64_t)) != sizeof(uint64_t)) {
+            printf("%-18s n/a\n", counters[k].name);
+            counter_fd[k] = -1;
+            continue;
+        }
+        printf("%-18s %.3g\n", counters[k].name, (double)count[k]);
+        close(counter_fd[k]);
+    }
+    if (counter_fd[0] >= 0 && counter_fd[1] >= 0 && count[0]) {
+        printf("cache miss rate    %.2f %%\n", 100.0 * count[1] / count[0]);
+    }
+    if (counter_fd[2] >= 0 && counter_fd[3] >= 0 && count[2]) {
+        printf("L1d miss rate      %.2f %%\n", 100.0 * count[3] / count[2]);
+    }
+
+    int status = 0;
+    if (write_path) {
+        status |= write_take(write_path);
+    }
+    if (compare_path) {
+        status |= compare_take(compare_path);
+    }
+    free(take);
+
+    for (uint32_t t = 0 ; t < n_threads ; ++t) {
+        free(workers[t].cycle_time);
+    }
+    for (uint32_t i = 0 ; i < n_instances ; ++i) {
+        host_cleanup(hosts[i]);
+        free(hosts[i]);
+        free(outputs[i]);
+    }
+    pthread_barrier_destroy(&barrier);
+    return status;
+}
@@ -0,0 +1,342 @@
+/**
+    Bollie Retain - (c) 2016 Thomas Ebeling https://ca9.eu
+
+    This file is part of bollieretain.lv2
+
+    bollieretain.lv2 is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    bollieretain.lv2 is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with bollieretain.lv2.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+* \file host.h
+* \author Bollie
+* \brief Minimal LV2 host side shared by the offline tools
+*
+* Provides the URID map, a deferred worker and the control ports of an
+* instance. Audio ports are connected by the tool.
+*/
+
+#ifndef BOLLIERETAIN_HOST_H
+#define BOLLIERETAIN_HOST_H
+
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lv2/lv2plug.in/ns/lv2core/lv2.h"
+#include "lv2/lv2plug.in/ns/ext/atom/atom.h"
+#include "lv2/lv2plug.in/ns/ext/atom/util.h"
+#include "lv2/lv2plug.in/ns/ext/urid/urid.h"
+#include "lv2/lv2plug.in/ns/ext/worker/worker.h"
+
+#define HOST_MAX_URIS 64        ///< Capacity of the URID map
+#define HOST_QUEUE_LEN 4096     ///< Worker queue size in bytes
+#define HOST_SEQUENCE_LEN 4096  ///< Control sequence size in bytes
+#define HOST_N_PORTS 40         ///< Number of plugin ports
+#define HOST_NO_VALUE -1e30f    ///< Default of ports that aren't controls
+
+/**
+* Port symbols and defaults as declared in bollieretain.ttl, audio, CV and
+* atom ports have HOST_NO_VALUE. Not NAN, -ffast-math folds isnan() away.
+*/
+static const struct {
+    const char* symbol;
+    float value;
+} host_ports[HOST_N_PORTS] = {
+    {"blend", 30.0f}, {"trigger", 0}, {"in_l", HOST_NO_VALUE},
+    {"in_r", HOST_NO_VALUE}, {"out_l", HOST_NO_VALUE},
+    {"out_r", HOST_NO_VALUE}, {"seam", 0}, {"mode", 0}, {"stretch", 4.0f},
+    {"scatter", 0}, {"control", HOST_NO_VALUE}, {"attack", 10.0f},
+    {"decay", 200.0f}, {"sustain", 80.0f}, {"release", 300.0f},
+    {"filter", 0}, {"filter_freq", 2000.0f}, {"tilt", -6.0f}, {"bands", 0},
+    {"crossover", 500.0f}, {"low", 100.0f}, {"high", 100.0f},
+    {"width", 100.0f}, {"normalize", 0}, {"quality", 1.0f}, {"freewheel", 0},
+    {"cpu_budget", 0}, {"hold", 0}, {"hold_release", 500.0f},
+    {"phase", HOST_NO_VALUE}, {"wrap", HOST_NO_VALUE}, {"duck", 0},
+    {"duck_threshold", -30.0f}, {"duck_attack", 10.0f},
+    {"duck_release", 250.0f}, {"key_l", HOST_NO_VALUE},
+    {"key_r", HOST_NO_VALUE}, {"window_start", 0}, {"window_end", 100.0f},
+    {"sync", 0},
+};
+
+/**
+* A hosted plugin instance with its features and control ports. Must not
+* move in memory while instantiated, the features point into it.
+*/
+typedef struct {
+    const LV2_Descriptor* descriptor;
+    LV2_Handle instance;
+    const LV2_Worker_Interface* worker;
+    bool active;
+
+    LV2_URID_Map map;
+    LV2_Worker_Schedule schedule;
+    LV2_Feature map_feature;
+    LV2_Feature schedule_feature;
+    const LV2_Feature* features[3];
+
+    float control[HOST_N_PORTS];        ///< Control port values
+    union {
+        LV2_Atom_Sequence sequence;     ///< Events of the next run
+        uint8_t sequence_buffer[HOST_SEQUENCE_LEN];
+    };
+
+    uint8_t requests[HOST_QUEUE_LEN];   ///< Worker jobs of the last run
+    uint32_t n_requests;                ///< Bytes used in the job queue
+    uint8_t responses[HOST_QUEUE_LEN];  ///< Worker responses to deliver
+    uint32_t n_responses;               ///< Bytes used in the response queue
+} HostInstance;
+
+static const char* host_uris[HOST_MAX_URIS];
+static uint32_t host_n_uris;
+static pthread_mutex_t host_uri_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**
+* Maps URIs to URIDs, shared by all instances and threads.
+*/
+static inline LV2_URID host_map_uri(LV2_URID_Map_Handle handle,
+    const char* uri) {
+    LV2_URID urid = 0;
+
+    pthread_mutex_lock(&host_uri_lock);
+    for (uint32_t i = 0 ; i < host_n_uris ; ++i) {
+        if (!strcmp(host_uris[i], uri)) {
+            urid = i + 1;
+        }
+    }
+    if (!urid && host_n_uris < HOST_MAX_URIS) {
+        host_uris[host_n_uris++] = strdup(uri);
+        urid = host_n_uris;
+    }
+    pthread_mutex_unlock(&host_uri_lock);
+
+    return urid;
+}
+
+
+/**
+* Looks up a control port by symbol or index.
+* \return port index or -1 for unknown or non control ports
+*/
+static inline int host_find_port(const char* name) {
+    char* end;
+    long index = strtol(name, &end, 10);
+
+    if (*end) {
+        index = -1;
+        for (int p = 0 ; p < HOST_N_PORTS ; ++p) {
+            if (!strcmp(host_ports[p].symbol, name)) {
+                index = p;
+            }
+        }
+    }
+    if (index < 0 || index >= HOST_N_PORTS
+        || host_ports[index].value == HOST_NO_VALUE) {
+        return -1;
+    }
+    return index;
+}
+
+
+/**
+* Appends a size prefixed message to a queue.
+*/
+static inline LV2_Worker_Status host_push(uint8_t* queue, uint32_t* used,
+    uint32_t size, const void* data) {
+    if (*used + sizeof(uint32_t) + size > HOST_QUEUE_LEN) {
+        return LV2_WORKER_ERR_NO_SPACE;
+    }
+    memcpy(queue + *used, &size, sizeof(uint32_t));
+    memcpy(queue + *used + sizeof(uint32_t), data, size);
+    *used += sizeof(uint32_t) + size;
+
+    return LV2_WORKER_SUCCESS;
+}
+
+
+static inline LV2_Worker_Status host_respond(LV2_Worker_Respond_Handle handle,
+    uint32_t size, const void* data) {
+    HostInstance* host = (HostInstance*)handle;
+
+    return host_push(host->responses, &host->n_responses, size, data);
+}
+
+
+static inline LV2_Worker_Status host_schedule(
+    LV2_Worker_Schedule_Handle handle, uint32_t size, const void* data) {
+    HostInstance* host = (HostInstance*)handle;
+
+    return host_push(host->requests, &host->n_requests, size, data);
+}
+
+
+/**
+* Does the worker side of the last run calls, the responses stay queued.
+* \param host hosted instance
+*/
+static inline void host_do_work(HostInstance* host) {
+    uint32_t offset = 0;
+    uint32_t size;
+
+    while (offset < host->n_requests) {
+        memcpy(&size, host->requests + offset, sizeof(uint32_t));
+        host->worker->work(host->instance, host_respond, host, size,
+            host->requests + offset + sizeof(uint32_t));
+        offset += sizeof(uint32_t) + size;
+    }
+    host->n_requests = 0;
+}
+
+
+/**
+* Delivers the oldest queued worker response.
+* \param host hosted instance
+* \return false if none was queued
+*/
+static inline bool host_deliver_response(HostInstance* host) {
+    uint32_t size;
+
+    if (!host->n_responses) {
+        return false;
+    }
+    memcpy(&size, host->responses, sizeof(uint32_t));
+    host->worker->work_response(host->instance, size,
+        host->responses + sizeof(uint32_t));
+    host->n_responses -= sizeof(uint32_t) + size;
+    memmove(host->responses, host->responses + sizeof(uint32_t) + size,
+        host->n_responses);
+    return true;
+}
+
+
+/**
+* Does the worker side of the last run calls and delivers the responses,
+* like a worker thread finishing between two cycles.
+* \param host hosted instance
+*/
+static inline void host_run_work(HostInstance* host) {
+    host_do_work(host);
+    while (host_deliver_response(host)) {
+    }
+}
+
+
+/**
+* Adds an event to the control sequence of the next run.
+* \return false if the sequence is full
+*/
+static inline bool host_append_event(HostInstance* host, uint32_t frames,
+    LV2_URID type, uint32_t size, const void* data) {
+    struct {
+        LV2_Atom_Event event;
+        uint8_t data[256];
+    } ev;
+
+    if (size > sizeof(ev.data)) {
+        return false;
+    }
+    ev.event.time.frames = frames;
+    ev.event.body.type = type;
+    ev.event.body.size = size;
+    memcpy(ev.data, data, size);
+
+    return lv2_atom_sequence_append_event(&host->sequence,
+        HOST_SEQUENCE_LEN - sizeof(LV2_Atom), &ev.event) != NULL;
+}
+
+
+/**
+* Activates the plugin, deactivating it first if it runs already, like a
+* host restarting its processing.
+* \param host hosted instance
+*/
+static inline void host_activate(HostInstance* host) {
+    if (host->active && host->descriptor->deactivate) {
+        host->descriptor->deactivate(host->instance);
+    }
+    host->descriptor->activate(host->instance);
+    host->active = true;
+}
+
+
+/**
+* Instantiates the plugin with its control ports connected.
+* \param host instance to set up
+* \param descriptor plugin descriptor
+* \param rate sample rate
+* \param initial control values, NULL for the defaults
+* \param activate activate it as well
+* \return true on success
+*/
+static inline bool host_instantiate(HostInstance* host,
+    const LV2_Descriptor* descriptor, double rate, const float* initial,
+    bool activate) {
+    host->descriptor = descriptor;
+    host->active = false;
+    host->n_requests = 0;
+    host->n_responses = 0;
+
+    host->map.handle = NULL;
+    host->map.map = host_map_uri;
+    host->schedule.handle = host;
+    host->schedule.schedule_work = host_schedule;
+    host->map_feature.URI = LV2_URID__map;
+    host->map_feature.data = &host->map;
+    host->schedule_feature.URI = LV2_WORKER__schedule;
+    host->schedule_feature.data = &host->schedule;
+    host->features[0] = &host->map_feature;
+    host->features[1] = &host->schedule_feature;
+    host->features[2] = NULL;
+
+    host->instance = descriptor->instantiate(descriptor, rate, "",
+        host->features);
+    if (!host->instance) {
+        return false;
+    }
+    host->worker = descriptor->extension_data(LV2_WORKER__interface);
+
+    host->sequence.atom.size = sizeof(LV2_Atom_Sequence_Body);
+    host->sequence.atom.type = 0;
+    host->sequence.body.unit = 0;
+    host->sequence.body.pad = 0;
+
+    for (uint32_t p = 0 ; p < HOST_N_PORTS ; ++p) {
+        host->control[p] = initial ? initial[p] : host_ports[p].value;
+        if (host_ports[p].value != HOST_NO_VALUE) {
+            descriptor->connect_port(host->instance, p, &host->control[p]);
+        }
+    }
+    descriptor->connect_port(host->instance, 10, &host->sequence);
+    if (activate) {
+        host_activate(host);
+    }
+
+    return true;
+}
+
+
+/**
+* Deactivates and frees the plugin instance.
+*/
+static inline void host_cleanup(HostInstance* host) {
+    if (host->active && host->descriptor->deactivate) {
+        host->descriptor->deactivate(host->instance);
+    }
+    host->descriptor->cleanup(host->instance);
+}
+
+#endif